@@ -2,10 +2,34 @@
 
 clear
 
-SOURCES=$(find . -name "*.c")
-LIBS="-lm"
+# Exported for the checks, which compile generated code with it
+export CC=${CC:-clang}
+SOURCES="slim.c"
+LIBS="-lm -ldl -lpthread"
 CFLAGS="-Wall -Werror -O3"
 
 set -xe 
 
-clang $SOURCES -o exe $LIBS $CFLAGS
\ No newline at end of file
+# The host exports the slim API so compiled programs can bind against it
+$CC $SOURCES test.c -o exe $LIBS $CFLAGS -rdynamic
+$CC $SOURCES tools/slim_aot.c -o slim-aot $LIBS $CFLAGS
+$CC $SOURCES tools/slim_opt.c -o slim-opt $LIBS $CFLAGS
+$CC $SOURCES tools/slim_bench.c -o slim-bench $LIBS $CFLAGS -rdynamic -DSLIM_QUIET
+$CC $SOURCES tools/slim_mod.c -o slim-mod $LIBS $CFLAGS
+
+# Run the checks, failures are reported on stderr
+./exe > /dev/null
+
+# Ahead-of-time compile the benchmark and compare it against the interpreter, with and without traces, all quiet
+./slim-aot bench.slx bench.aot.c
+$CC -shared -fPIC -I. bench.aot.c -o bench.so $CFLAGS -DSLIM_QUIET
+./slim-bench -n 10 -t bench.slx bench.slx -o ./bench.so bench.slx
+
+# Optimize the naively generated benchmark and compare it against the original
+./slim-opt bench_naive.slx bench_naive.opt.slx
+./slim-bench -n 10 -t bench_naive.slx -t bench_naive.opt.slx
+
+# Link two modules and run them, only the functions that are reached get loaded
+./slim-mod pack mod_main.slx mod_main.slm -f main@0 -f finish@18 -i double
+./slim-mod pack mod_lib.slx mod_lib.slm -f double@0 -f unused@27 -i finish
+./slim-mod run mod_main.slm mod_lib.slm
@@ -1,4 +1,17 @@
 #include "slim.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 // Internal Routines ---------------------------------------------------------------------------------------------------
 SlimBytecode* slim_bytecode_load(const char* filename) {
     // Open the file
@@ -43,12 +56,49 @@ void slim_bytecode_destroy(SlimBytecode* bytecode) {
     free(bytecode);
 }
 
+// Identifies bytecode for compiled objects, a word per multiply rather than a byte
+u64_t slim_bytecode_hash(const u8_t* data, u32_t size) {
+    u64_t hash = 0xCBF29CE484222325ULL ^ size;
+    u32_t i = 0;
+    for (; i + sizeof(u64_t) <= size; i += sizeof(u64_t)) {
+        u64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+
+    for (; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+SlimInstruction slim_instruction_decode(const u8_t* data) {
+    SlimInstruction instruction;
+    instruction.opcode = data[0];
+    instruction.arg1 = (u32_t)data[1] << 24 | (u32_t)data[2] << 16 | (u32_t)data[3] << 8 | (u32_t)data[4];
+    instruction.arg2 = (u32_t)data[5] << 24 | (u32_t)data[6] << 16 | (u32_t)data[7] << 8 | (u32_t)data[8];
+    return instruction;
+}
+
+void slim_instruction_encode(u8_t* data, SlimInstruction instruction) {
+    data[0] = instruction.opcode;
+    for (int i = 0; i < 4; i++) {
+        data[1 + i] = (instruction.arg1 >> ((3 - i) * 8)) & 0xFF;
+        data[5 + i] = (instruction.arg2 >> ((3 - i) * 8)) & 0xFF;
+    }
+}
+
 SlimError ___slim_machine_push(SlimMachine* machine, u64_t value) {
     if (machine->stack_pointer >= SLIM_MACHINE_STACK_SIZE) {
         return SL_ERROR_STACK_OVERFLOW;
     }
 
     machine->stack[machine->stack_pointer++] = value;
+    if (machine->stack_pointer > machine->stats.stack_high) {
+        machine->stats.stack_high = machine->stack_pointer;
+    }
 
     return SL_ERROR_NONE;
 }
@@ -122,12 +172,13 @@ SlimError ___slim_machine_write(SlimMachine* machine, u32_t address, u32_t offse
 
     u64_t* ptr = (u64_t*)(machine->memory + address + offset);
     *ptr = value;
+    slim_machine_mark_dirty(machine, address + offset, 1);
 
     return SL_ERROR_NONE;
 }
 
 // TODO: Validate Me
-SlimError slim_machine_alloc(SlimMachine* machine, u32_t size, u32_t* address) {
+SlimError ___slim_machine_alloc(SlimMachine* machine, u32_t size, u32_t* address) {
     SlimBlock* block = machine->blocks;
     while (block != NULL) {
         if (block->allocated == 0 && block->end - block->start >= size) {
@@ -138,6 +189,7 @@ SlimError slim_machine_alloc(SlimMachine* machine, u32_t size, u32_t* address) {
 
             block->allocated = 1;
             *address = block->start;
+            machine->stats.allocs++;
             return SL_ERROR_NONE;
         }
 
@@ -158,6 +210,7 @@ SlimError ___slim_machine_free(SlimMachine* machine, u32_t address) {
                 return error;
             }
 
+            machine->stats.frees++;
             return SL_ERROR_NONE;
         }
 
@@ -166,14 +219,242 @@ SlimError ___slim_machine_free(SlimMachine* machine, u32_t address) {
 
     return SL_ERROR_BLOCK_FREE;
 }
+SlimError ___slim_machine_native(SlimMachine* machine, u32_t index) {
+    if (index >= SLIM_MACHINE_NATIVES || machine->natives[index].function == NULL) {
+        return SL_ERROR_INVALID_NATIVE;
+    }
+
+    SlimNativeEntry* native = &machine->natives[index];
+    if (machine->stack_pointer < native->arity) {
+        return SL_ERROR_STACK_UNDERFLOW;
+    }
+
+    if (native->arity == 0 && machine->stack_pointer >= SLIM_MACHINE_STACK_SIZE) {
+        return SL_ERROR_STACK_OVERFLOW;
+    }
+
+    // The arguments are handed over where they are, the result takes the place of the deepest one
+    u64_t* args = machine->stack + machine->stack_pointer - native->arity;
+    u64_t result = 0;
+    SlimError error = native->function(machine, args, native->arity, &result);
+    if (error != SL_ERROR_NONE) {
+        return error;
+    }
+
+    for (u32_t i = 0; i < native->arity; i++) {
+        args[i] = 0;
+    }
+    machine->stack_pointer -= native->arity;
+    machine->stack[machine->stack_pointer++] = result;
+    if (machine->stack_pointer > machine->stats.stack_high) {
+        machine->stats.stack_high = machine->stack_pointer;
+    }
+
+    return SL_ERROR_NONE;
+}
+
+SlimError ___slim_machine_native_memory(SlimMachine* machine, u32_t index, u32_t address, u32_t length) {
+    if (index >= SLIM_MACHINE_NATIVES || machine->natives[index].function == NULL) {
+        return SL_ERROR_INVALID_NATIVE;
+    }
+
+    if (address > SLIM_MACHINE_MEMORY_SIZE || length > SLIM_MACHINE_MEMORY_SIZE - address) {
+        return SL_ERROR_INVALID_ADDRESS;
+    }
+
+    // The range is writable from the native
+    slim_machine_mark_dirty(machine, address, length);
+
+    u64_t result = 0;
+    SlimError error = machine->natives[index].function(machine, machine->memory + address, length, &result);
+    if (error != SL_ERROR_NONE) {
+        return error;
+    }
+
+    return ___slim_machine_push(machine, result);
+}
+SlimError ___slim_machine_send(SlimMachine* machine, u32_t index, u64_t* values, u32_t count) {
+    if (index >= SLIM_MACHINE_CHANNELS || machine->channels[index] == NULL) {
+        return SL_ERROR_INVALID_CHANNEL;
+    }
+
+    // A batch larger than the ring would never go through
+    if (count > machine->channels[index]->capacity) {
+        return SL_ERROR_INVALID_CHANNEL;
+    }
+
+    if (count > 0 && slim_channel_send(machine->channels[index], values, count) == 0) {
+        machine->blocked = machine->channels[index];
+        machine->blocked_count = count;
+        machine->blocked_send = 1;
+        return SL_ERROR_CHANNEL_FULL;
+    }
+
+    return SL_ERROR_NONE;
+}
+
+SlimError ___slim_machine_receive(SlimMachine* machine, u32_t index, u64_t* values, u32_t count) {
+    if (index >= SLIM_MACHINE_CHANNELS || machine->channels[index] == NULL) {
+        return SL_ERROR_INVALID_CHANNEL;
+    }
+
+    if (count > machine->channels[index]->capacity) {
+        return SL_ERROR_INVALID_CHANNEL;
+    }
+
+    if (count > 0 && slim_channel_receive(machine->channels[index], values, count) == 0) {
+        machine->blocked = machine->channels[index];
+        machine->blocked_count = count;
+        machine->blocked_send = 0;
+        return SL_ERROR_CHANNEL_EMPTY;
+    }
+
+    return SL_ERROR_NONE;
+}
+
+static void slim_machine_release_child(SlimMachine* child) {
+    child->bytecode = NULL;
+    slim_machine_destroy(child);
+}
+
+static void* slim_task_thread(void* argument) {
+    slim_task_run(argument);
+    return NULL;
+}
+
+SlimError ___slim_machine_spawn(SlimMachine* machine, u32_t address, u64_t argument) {
+    if (machine->child_count >= SLIM_MACHINE_CHILDREN) {
+        return SL_ERROR_SPAWN;
+    }
+
+    SlimMachine* child = slim_machine_create();
+    SlimTask* task = malloc(sizeof(SlimTask));
+    if (child == NULL || task == NULL) {
+        free(task);
+        if (child) {
+            slim_machine_destroy(child);
+        }
+        return SL_ERROR_SPAWN;
+    }
+
+    // Everything bound by the host is shared, the object handle stays with the parent
+    child->bytecode = machine->bytecode;
+    child->bytecode_size = machine->bytecode_size;
+    child->entry = machine->entry;
+    child->image = machine->image;
+    child->scheduler = machine->scheduler;
+    memcpy(child->natives, machine->natives, sizeof(machine->natives));
+    memcpy(child->channels, machine->channels, sizeof(machine->channels));
+    child->segment = machine->segment;
+    memcpy(child->memory, machine->memory, sizeof(u64_t) * machine->memory_high);
+    child->memory_high = machine->memory_high;
+
+    child->stack[0] = argument;
+    child->stack_pointer = 1;
+    child->instruction_pointer = address;
+
+    task->machine = child;
+    atomic_init(&task->done, 0);
+
+    // Without a scheduler every child gets its own thread, so it can talk to its parent over channels before JOIN
+    if (machine->scheduler == NULL && pthread_create(&task->thread, NULL, slim_task_thread, task) != 0) {
+        slim_machine_release_child(child);
+        free(task);
+        return SL_ERROR_SPAWN;
+    }
+
+    machine->children[machine->child_count++] = task;
+    if (machine->scheduler) {
+        slim_scheduler_submit(machine->scheduler, task);
+    }
+
+    return SL_ERROR_NONE;
+}
+
+// Waits for a child to halt and takes it over from its task
+static SlimMachine* slim_machine_reap(SlimMachine* machine, SlimTask* task) {
+    if (machine->scheduler) {
+        slim_scheduler_wait(machine->scheduler, task);
+    } else {
+        pthread_join(task->thread, NULL);
+    }
+
+    SlimMachine* child = task->machine;
+    free(task);
+    return child;
+}
+
+SlimError ___slim_machine_join(SlimMachine* machine) {
+    SlimError error = SL_ERROR_NONE;
+
+    // Every child is collected even after a failure, the first error is reported
+    for (u32_t i = 0; i < machine->child_count; i++) {
+        SlimMachine* child = slim_machine_reap(machine, machine->children[i]);
+
+        u64_t result = child->stack_pointer > 0 ? child->stack[child->stack_pointer - 1] : 0;
+        if (child->flags.error && error == SL_ERROR_NONE) {
+            error = SL_ERROR_SPAWN;
+        }
+
+        if (error == SL_ERROR_NONE) {
+            error = ___slim_machine_push(machine, result);
+        }
+
+        // The work done by children shows up in the parent's counters, each child as one more machine
+        child->stats.machines++;
+        slim_stats_merge(&machine->stats, &child->stats);
+        slim_machine_release_child(child);
+        machine->children[i] = NULL;
+    }
+
+    machine->child_count = 0;
+    return error;
+}
+
+SlimError ___slim_machine_shared(SlimMachine* machine, u64_t address, u32_t offset, _Atomic u64_t** word) {
+    if (machine->segment == NULL) {
+        return SL_ERROR_SEGMENT;
+    }
+
+    if (address + offset >= machine->segment->size) {
+        return SL_ERROR_INVALID_ADDRESS;
+    }
+
+    *word = &machine->segment->words[address + offset];
+    return SL_ERROR_NONE;
+}
+
+SlimError ___slim_machine_stream(SlimMachine* machine, u32_t index, SlimStream** stream) {
+    if (index >= SLIM_MACHINE_STREAMS || machine->streams[index] == NULL) {
+        return SL_ERROR_STREAM;
+    }
+
+    *stream = machine->streams[index];
+    return SL_ERROR_NONE;
+}
+
+SlimError ___slim_machine_table(SlimMachine* machine, u64_t handle, SlimTable** table) {
+    if (handle >= SLIM_MACHINE_TABLES || machine->tables[handle] == NULL) {
+        return SL_ERROR_TABLE;
+    }
+
+    *table = machine->tables[handle];
+    return SL_ERROR_NONE;
+}
+
+// Leaves the instruction pointer on the current instruction and hands control back to the host
+static void slim_machine_wait(SlimMachine* machine) {
+    machine->instruction_pointer -= SLIM_INSTRUCTION_SIZE;
+    machine->flags.wait = 1;
+}
 // Routines and Operations ---------------------------------------------------------------------------------------------
 void slim_routine_nop(SlimMachine* machine, SlimInstruction instruction) {
-    printf("NOP\n");
+    slim_print("NOP\n");
     return;
 }
 
 void slim_routine_halt(SlimMachine* machine, SlimInstruction instruction) {
-    printf("HALT\n");
+    slim_print("HALT\n");
     machine->flags.halt = 1;
     return;
 }
@@ -182,19 +463,19 @@ void slim_routine_loadi(SlimMachine* machine, SlimInstruction instruction) {
     SlimError error;
 
     u64_t value = (u64_t)instruction.arg1 << 32 | instruction.arg2;
-    printf("LOADI %lld\n", value);
+    slim_print("LOADI %lld\n", value);
 
     error = ___slim_machine_push(machine, value);
 
     if (error != SL_ERROR_NONE) {
-        printf("ERROR: %d\n", error);
+        slim_print("ERROR: %d\n", error);
     }
 
     slim_machine_except(machine, error);
 }
 
 void slim_routine_loadr(SlimMachine* machine, SlimInstruction instruction) {
-    printf("LOADR %d\n", instruction.arg1);
+    slim_print("LOADR %d\n", instruction.arg1);
 
     u32_t index = instruction.arg1;
 
@@ -205,7 +486,7 @@ void slim_routine_loadr(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_loadm(SlimMachine* machine, SlimInstruction instruction) {
-    printf("LOADM %x, %x\n", instruction.arg1, instruction.arg2);
+    slim_print("LOADM %x, %x\n", instruction.arg1, instruction.arg2);
 
     u64_t address = 0;
     // TODO: Which arg is it?
@@ -222,16 +503,17 @@ void slim_routine_loadm(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_drop(SlimMachine* machine, SlimInstruction instruction) {
-    printf("DROP\n");
+    slim_print("DROP\n");
 
-    SlimError error = ___slim_machine_pop(machine, NULL);
+    u64_t value;
+    SlimError error = ___slim_machine_pop(machine, &value);
     slim_machine_except(machine, error);
 
     return;
 }
 
 void slim_routine_storer(SlimMachine* machine, SlimInstruction instruction) {
-    printf("STORER %d\n", instruction.arg1);
+    slim_print("STORER %d\n", instruction.arg1);
 
     u32_t index = instruction.arg1;
     SlimError error;
@@ -243,7 +525,7 @@ void slim_routine_storer(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_storem(SlimMachine* machine, SlimInstruction instruction) {
-    printf("STOREM %d\n", instruction.arg1);
+    slim_print("STOREM %d\n", instruction.arg1);
 
     u64_t address;
     u64_t offset;
@@ -261,7 +543,7 @@ void slim_routine_storem(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_dup(SlimMachine* machine, SlimInstruction instruction) {
-    printf("DUP\n");
+    slim_print("DUP\n");
 
     u64_t value;
     SlimError error;
@@ -279,7 +561,7 @@ void slim_routine_dup(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_swap(SlimMachine* machine, SlimInstruction instruction) {
-    printf("SWAP\n");
+    slim_print("SWAP\n");
     u64_t a;
     u64_t b;
     SlimError error;
@@ -300,7 +582,7 @@ void slim_routine_swap(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_rot(SlimMachine* machine, SlimInstruction instruction) {
-    printf("ROT\n");
+    slim_print("ROT\n");
 
     u64_t a;
     u64_t b;
@@ -329,7 +611,7 @@ void slim_routine_rot(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_add(SlimMachine* machine, SlimInstruction instruction) {
-    printf("ADD\n");
+    slim_print("ADD\n");
 
     u64_t a;
     u64_t b;
@@ -350,7 +632,7 @@ void slim_routine_add(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_sub(SlimMachine* machine, SlimInstruction instruction) {
-    printf("SUB\n");
+    slim_print("SUB\n");
 
     u64_t a;
     u64_t b;
@@ -371,7 +653,7 @@ void slim_routine_sub(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_mul(SlimMachine* machine, SlimInstruction instruction) {
-    printf("MUL\n");
+    slim_print("MUL\n");
 
     u64_t a;
     u64_t b;
@@ -392,7 +674,7 @@ void slim_routine_mul(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_div(SlimMachine* machine, SlimInstruction instruction) {
-    printf("DIV\n");
+    slim_print("DIV\n");
 
     u64_t a;
     u64_t b;
@@ -433,14 +715,14 @@ void slim_routine_divf(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_alloc(SlimMachine* machine, SlimInstruction instruction) {
-    printf("ALLOC %d\n", instruction.arg1);
+    slim_print("ALLOC %d\n", instruction.arg1);
 
     u32_t size = instruction.arg1;
     SlimError error;
 
     u32_t address;
 
-    error = slim_machine_alloc(machine, size, &address);
+    error = ___slim_machine_alloc(machine, size, &address);
     slim_machine_except(machine, error);
 
     error = ___slim_machine_push(machine, address);
@@ -450,7 +732,7 @@ void slim_routine_alloc(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_free(SlimMachine* machine, SlimInstruction instruction) {
-    printf("FREE %d\n", instruction.arg1);
+    slim_print("FREE %d\n", instruction.arg1);
 
     SlimError error = ___slim_machine_free(machine, instruction.arg1);
     slim_machine_except(machine, error);
@@ -459,14 +741,14 @@ void slim_routine_free(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_jmp(SlimMachine* machine, SlimInstruction instruction) {
-    printf("JUMP %d\n", instruction.arg1);
+    slim_print("JUMP %d\n", instruction.arg1);
 
     u32_t address = instruction.arg1;
     machine->instruction_pointer = address;
 }
 
 void slim_routine_jne(SlimMachine* machine, SlimInstruction instruction) {
-    printf("JNE %d\n", instruction.arg1);
+    slim_print("JNE %d\n", instruction.arg1);
 
     u64_t value;
     SlimError error = ___slim_machine_pop(machine, &value);
@@ -478,7 +760,7 @@ void slim_routine_jne(SlimMachine* machine, SlimInstruction instruction) {
 }
 
 void slim_routine_je(SlimMachine* machine, SlimInstruction instruction) {
-    printf("JE %d\n", instruction.arg1);
+    slim_print("JE %d\n", instruction.arg1);
 
     u64_t value;
     SlimError error = ___slim_machine_pop(machine, &value);
@@ -489,159 +771,2371 @@ void slim_routine_je(SlimMachine* machine, SlimInstruction instruction) {
     }
 }
 
-// Fetch, Decode, Execute ----------------------------------------------------------------------------------------------
-SlimInstruction slim_machine_fetch(SlimMachine* machine) {
-    SlimInstruction instruction;
-    instruction.opcode = machine->bytecode[machine->instruction_pointer];
+void slim_routine_native(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("NATIVE %d\n", instruction.arg1);
 
-    // Read in the next 4 bytes as the first argument
-    u32_t arg1 = 0;
-    for (int i = 0; i < 4; i++) {
-        arg1 |= machine->bytecode[machine->instruction_pointer + 1 + i] << (i * 8);
-    }
-    // Reverse the bits
-    arg1 = ((arg1 & 0x000000FF) << 24) | ((arg1 & 0x0000FF00) << 8) | ((arg1 & 0x00FF0000) >> 8) |
-           ((arg1 & 0xFF000000) >> 24);
+    SlimError error = ___slim_machine_native(machine, instruction.arg1);
+    slim_machine_except(machine, error);
 
-    // Read in the next 4 bytes as the second argument
-    u32_t arg2 = 0;
-    for (int i = 0; i < 4; i++) {
-        arg2 |= machine->bytecode[machine->instruction_pointer + 5 + i] << (i * 8);
-    }
-    // Reverse the bits
-    arg2 = ((arg2 & 0x000000FF) << 24) | ((arg2 & 0x0000FF00) << 8) | ((arg2 & 0x00FF0000) >> 8) |
-           ((arg2 & 0xFF000000) >> 24);
+    return;
+}
 
-    instruction.arg1 = arg1;
-    instruction.arg2 = arg2;
+void slim_routine_nativem(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("NATIVEM %d\n", instruction.arg1);
 
-    printf("Fetch: 0x%x 0x%x 0x%x\n", instruction.opcode, instruction.arg1, instruction.arg2);
+    u64_t address;
+    u64_t length;
+    SlimError error;
 
-    machine->instruction_pointer += 9;
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
 
-    return instruction;
-}
+    error = ___slim_machine_pop(machine, &length);
+    slim_machine_except(machine, error);
 
-SlimRoutine slim_machine_decode(SlimMachine* machine, SlimInstruction instruction) {
-    switch (instruction.opcode) {
-    case SL_OPCODE_NOOP: return slim_routine_nop; break;
-    case SL_OPCODE_HALT: return slim_routine_halt; break;
-    case SL_OPCODE_LOADI: return slim_routine_loadi; break;
-    case SL_OPCODE_LOADR: return slim_routine_loadr; break;
-    case SL_OPCODE_LOADM: return slim_routine_loadm; break;
-    case SL_OPCODE_DROP: return slim_routine_drop; break;
-    case SL_OPCODE_STORER: return slim_routine_storer; break;
-    case SL_OPCODE_STOREM: return slim_routine_storem; break;
-    case SL_OPCODE_DUP: return slim_routine_dup; break;
-    case SL_OPCODE_SWAP: return slim_routine_swap; break;
-    case SL_OPCODE_ROT: return slim_routine_rot; break;
-    case SL_OPCODE_ADD: return slim_routine_add; break;
-    case SL_OPCODE_SUB: return slim_routine_sub; break;
-    case SL_OPCODE_MUL: return slim_routine_mul; break;
-    case SL_OPCODE_DIV: return slim_routine_div; break;
-    case SL_OPCODE_ADDF: return slim_routine_addf; break;
-    case SL_OPCODE_SUBF: return slim_routine_subf; break;
-    case SL_OPCODE_MULF: return slim_routine_mulf; break;
-    case SL_OPCODE_DIVF: return slim_routine_divf; break;
-    case SL_OPCODE_ALLOC: return slim_routine_alloc; break;
-    case SL_OPCODE_FREE: return slim_routine_free; break;
-    case SL_OPCODE_JMP: return slim_routine_jmp; break;
-    case SL_OPCODE_JNE: return slim_routine_jne; break;
-    case SL_OPCODE_JE: return slim_routine_je; break;
-    default: return NULL; break;
-    }
-}
+    error = ___slim_machine_native_memory(machine, instruction.arg1, (u32_t)address, (u32_t)length);
+    slim_machine_except(machine, error);
 
-void slim_machine_execute(SlimMachine* machine, SlimRoutine routine, SlimInstruction instruction) {
-    if (routine) {
-        routine(machine, instruction);
-    } else {
-        printf("Invalid instruction\n");
-        machine->flags.error = 1;
-    }
-}
-// External API --------------------------------------------------------------------------------------------------------
-SlimMachine* slim_machine_create() {
-    SlimMachine* machine = malloc(sizeof(SlimMachine));
-    machine->bytecode = NULL;
-    machine->bytecode_size = 0;
-    machine->blocks = slim_block_create(0, SLIM_MACHINE_MEMORY_SIZE);
-    return machine;
+    return;
 }
 
-void slim_machine_destroy(SlimMachine* machine) {
-    if (machine->bytecode) {
-        free(machine->bytecode);
+// Channel routines look at their operands before popping them, so a blocked instruction can simply run again
+void slim_routine_send(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("SEND %d\n", instruction.arg1);
+
+    u64_t value;
+    SlimError error = machine->stack_pointer == 0 ? SL_ERROR_STACK_UNDERFLOW : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    value = machine->stack[machine->stack_pointer - 1];
+    error = ___slim_machine_send(machine, instruction.arg1, &value, 1);
+    if (error == SL_ERROR_CHANNEL_FULL) {
+        slim_machine_wait(machine);
+        return;
     }
+    slim_machine_except(machine, error);
 
-    slim_block_destroy(machine->blocks);
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
 
-    free(machine);
+    return;
 }
 
-void slim_machine_clear(SlimMachine* machine) {
-    for (u32_t i = 0; i < SLIM_MACHINE_STACK_SIZE; i++) {
-        machine->stack[i] = 0;
-    }
+void slim_routine_recv(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("RECV %d\n", instruction.arg1);
 
-    for (u32_t i = 0; i < SLIM_MACHINE_REGISTERS; i++) {
-        machine->registers[i] = 0;
-    }
+    u64_t value;
+    SlimError error = machine->stack_pointer >= SLIM_MACHINE_STACK_SIZE ? SL_ERROR_STACK_OVERFLOW : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
 
-    for (u32_t i = 0; i < SLIM_MACHINE_MEMORY_SIZE; i++) {
-        machine->memory[i] = 0;
+    error = ___slim_machine_receive(machine, instruction.arg1, &value, 1);
+    if (error == SL_ERROR_CHANNEL_EMPTY) {
+        slim_machine_wait(machine);
+        return;
     }
+    slim_machine_except(machine, error);
 
-    // Reset Flags
-    machine->flags.zero = 0;
-    machine->flags.carry = 0;
-    machine->flags.overflow = 0;
-    machine->flags.negative = 0;
-    machine->flags.interrupt = 0;
-    machine->flags.decimal = 0;
-    machine->flags.error = 0;
-    machine->flags.halt = 0;
-
-    // Reset Pointers
-    machine->stack_pointer = 0;
-    machine->instruction_pointer = 0;
+    error = ___slim_machine_push(machine, value);
+    slim_machine_except(machine, error);
 
-    // Reset Blocks
-    slim_block_destroy(machine->blocks);
-    machine->blocks = slim_block_create(0, SLIM_MACHINE_MEMORY_SIZE);
+    return;
 }
 
-void slim_machine_load(SlimMachine* machine, u8_t* data, u32_t size) {
-    machine->bytecode = data;
-    machine->bytecode_size = size;
-}
+void slim_routine_tryrecv(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("TRYRECV %d\n", instruction.arg1);
 
-void slim_machine_launch(SlimMachine* machine) {
-    while (machine->flags.halt == 0) {
-        SlimInstruction instruction = slim_machine_fetch(machine);
-        SlimRoutine routine = slim_machine_decode(machine, instruction);
-        slim_machine_execute(machine, routine, instruction);
+    u64_t value = 0;
+    u64_t received = 1;
+    SlimError error = machine->stack_pointer + 2 > SLIM_MACHINE_STACK_SIZE ? SL_ERROR_STACK_OVERFLOW : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_receive(machine, instruction.arg1, &value, 1);
+    if (error == SL_ERROR_CHANNEL_EMPTY) {
+        received = 0;
+    } else {
+        slim_machine_except(machine, error);
     }
-    printf("Machine halted\n");
+
+    error = ___slim_machine_push(machine, value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, received);
+    slim_machine_except(machine, error);
+
+    return;
 }
-// Block Management ----------------------------------------------------------------------------------------------------
-SlimBlock* slim_block_create(u32_t start, u32_t end) {
-    SlimBlock* block = malloc(sizeof(SlimBlock));
-    if (block == NULL) {
-        return NULL;
+
+static SlimError slim_routine_channel_range(SlimMachine* machine, u32_t* address, u32_t* length) {
+    if (machine->stack_pointer < 2) {
+        return SL_ERROR_STACK_UNDERFLOW;
     }
-    block->allocated = 0;
-    block->start = start;
-    block->end = end;
-    block->next = NULL;
-    return block;
-}
 
-void slim_block_destroy(SlimBlock* block) {
-    if (block->next != NULL) {
-        slim_block_destroy(block->next);
+    u64_t top = machine->stack[machine->stack_pointer - 1];
+    u64_t second = machine->stack[machine->stack_pointer - 2];
+    if (top > SLIM_MACHINE_MEMORY_SIZE || second > SLIM_MACHINE_MEMORY_SIZE - top) {
+        return SL_ERROR_INVALID_ADDRESS;
     }
-    free(block);
+
+    *address = (u32_t)top;
+    *length = (u32_t)second;
+    return SL_ERROR_NONE;
+}
+
+void slim_routine_sendm(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("SENDM %d\n", instruction.arg1);
+
+    u32_t address;
+    u32_t length;
+    u64_t value;
+    SlimError error;
+
+    error = slim_routine_channel_range(machine, &address, &length);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_send(machine, instruction.arg1, machine->memory + address, length);
+    if (error == SL_ERROR_CHANNEL_FULL) {
+        slim_machine_wait(machine);
+        return;
+    }
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_recvm(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("RECVM %d\n", instruction.arg1);
+
+    u32_t address;
+    u32_t length;
+    u64_t value;
+    SlimError error;
+
+    error = slim_routine_channel_range(machine, &address, &length);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_receive(machine, instruction.arg1, machine->memory + address, length);
+    if (error == SL_ERROR_CHANNEL_EMPTY) {
+        slim_machine_wait(machine);
+        return;
+    }
+    slim_machine_except(machine, error);
+    slim_machine_mark_dirty(machine, address, length);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_spawn(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("SPAWN %d\n", instruction.arg1);
+
+    u64_t argument;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &argument);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_spawn(machine, instruction.arg1, argument);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_join(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("JOIN\n");
+
+    SlimError error = ___slim_machine_join(machine);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_loadm_acq(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("LOADM_ACQ %d\n", instruction.arg1);
+
+    u64_t address;
+    _Atomic u64_t* word;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_shared(machine, address, instruction.arg1, &word);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, atomic_load_explicit(word, memory_order_acquire));
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_storem_rel(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("STOREM_REL %d\n", instruction.arg1);
+
+    u64_t address;
+    u64_t value;
+    _Atomic u64_t* word;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_shared(machine, address, instruction.arg1, &word);
+    slim_machine_except(machine, error);
+
+    atomic_store_explicit(word, value, memory_order_release);
+
+    return;
+}
+
+void slim_routine_cas(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("CAS %d\n", instruction.arg1);
+
+    u64_t address;
+    u64_t desired;
+    u64_t expected;
+    _Atomic u64_t* word;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &desired);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &expected);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_shared(machine, address, instruction.arg1, &word);
+    slim_machine_except(machine, error);
+
+    // On failure expected is updated to the value found
+    u64_t swapped = atomic_compare_exchange_strong_explicit(
+        word, &expected, desired, memory_order_acq_rel, memory_order_acquire);
+
+    error = ___slim_machine_push(machine, expected);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, swapped);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_fetch_add(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("FETCH_ADD %d\n", instruction.arg1);
+
+    u64_t address;
+    u64_t value;
+    _Atomic u64_t* word;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_shared(machine, address, instruction.arg1, &word);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, atomic_fetch_add_explicit(word, value, memory_order_acq_rel));
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_xchg(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("XCHG %d\n", instruction.arg1);
+
+    u64_t address;
+    u64_t value;
+    _Atomic u64_t* word;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_shared(machine, address, instruction.arg1, &word);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, atomic_exchange_explicit(word, value, memory_order_acq_rel));
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_salloc(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("SALLOC %d\n", instruction.arg1);
+
+    u32_t address;
+    SlimError error = machine->segment == NULL ? SL_ERROR_SEGMENT : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    if (machine->segment_cache == NULL) {
+        machine->segment_cache = calloc(1, sizeof(SlimSegmentCache));
+    }
+
+    error = slim_segment_alloc(machine->segment, machine->segment_cache, instruction.arg1, &address);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, address);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_sfree(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("SFREE\n");
+
+    u64_t address;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &address);
+    slim_machine_except(machine, error);
+
+    error = machine->segment == NULL ? SL_ERROR_SEGMENT : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = address > SLIM_SEGMENT_NULL ? SL_ERROR_INVALID_ADDRESS : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    if (machine->segment_cache == NULL) {
+        machine->segment_cache = calloc(1, sizeof(SlimSegmentCache));
+    }
+
+    error = slim_segment_free(machine->segment, machine->segment_cache, (u32_t)address);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_read(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("READ %d\n", instruction.arg1);
+
+    SlimStream* stream;
+    SlimError error = machine->stack_pointer + 2 > SLIM_MACHINE_STACK_SIZE ? SL_ERROR_STACK_OVERFLOW : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_stream(machine, instruction.arg1, &stream);
+    slim_machine_except(machine, error);
+
+    // Little endian, a short read at the end of the input leaves the high bytes zero
+    u64_t count = stream->size - stream->position < 8 ? stream->size - stream->position : 8;
+    u64_t value = 0;
+    for (u64_t i = 0; i < count; i++) {
+        value |= (u64_t)stream->window[stream->position + i] << (i * 8);
+    }
+    stream->position += count;
+
+    error = ___slim_machine_push(machine, value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, count);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_readline(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("READLINE %d\n", instruction.arg1);
+
+    SlimStream* stream;
+    SlimError error = machine->stack_pointer + 3 > SLIM_MACHINE_STACK_SIZE ? SL_ERROR_STACK_OVERFLOW : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_stream(machine, instruction.arg1, &stream);
+    slim_machine_except(machine, error);
+
+    u64_t start = stream->position;
+    u64_t length = 0;
+    u64_t found = start < stream->size;
+    if (found) {
+        // The line stays in the mapping, only its offset and length go on the stack
+        const u8_t* newline = memchr(stream->window + start, '\n', stream->size - start);
+        length = newline ? (u64_t)(newline - stream->window) - start : stream->size - start;
+        stream->position = start + length + (newline ? 1 : 0);
+    } else {
+        start = 0;
+    }
+
+    error = ___slim_machine_push(machine, start);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, length);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, found);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_peek(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("PEEK %d\n", instruction.arg1);
+
+    u64_t offset;
+    SlimStream* stream;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &offset);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_stream(machine, instruction.arg1, &stream);
+    slim_machine_except(machine, error);
+
+    error = offset >= stream->size ? SL_ERROR_INVALID_ADDRESS : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, stream->window[offset]);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_write(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("WRITE %d %d\n", instruction.arg1, instruction.arg2);
+
+    u64_t value;
+    u8_t bytes[8];
+    SlimStream* stream;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_stream(machine, instruction.arg1, &stream);
+    slim_machine_except(machine, error);
+
+    error = instruction.arg2 > 8 ? SL_ERROR_STREAM : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    for (u32_t i = 0; i < instruction.arg2; i++) {
+        bytes[i] = (u8_t)(value >> (i * 8));
+    }
+
+    error = slim_stream_write(stream, bytes, instruction.arg2);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_writew(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("WRITEW %d %d\n", instruction.arg1, instruction.arg2);
+
+    u64_t offset;
+    u64_t length;
+    SlimStream* stream;
+    SlimStream* source;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &offset);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &length);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_stream(machine, instruction.arg1, &stream);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_stream(machine, instruction.arg2, &source);
+    slim_machine_except(machine, error);
+
+    error = offset > source->size || length > source->size - offset ? SL_ERROR_INVALID_ADDRESS : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = slim_stream_write(stream, source->window + offset, length);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_hnew(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("HNEW %d\n", instruction.arg1);
+
+    u32_t handle = 0;
+    while (handle < SLIM_MACHINE_TABLES && machine->tables[handle] != NULL) {
+        handle++;
+    }
+
+    SlimError error = handle == SLIM_MACHINE_TABLES ? SL_ERROR_TABLE : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = machine->stack_pointer >= SLIM_MACHINE_STACK_SIZE ? SL_ERROR_STACK_OVERFLOW : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    machine->tables[handle] = slim_table_create(instruction.arg1);
+    error = machine->tables[handle] == NULL ? SL_ERROR_TABLE : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, handle);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_hget(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("HGET\n");
+
+    u64_t key;
+    u64_t handle;
+    u64_t value = 0;
+    SlimTable* table;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &key);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &handle);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_table(machine, handle, &table);
+    slim_machine_except(machine, error);
+
+    u8_t found = slim_table_get(table, key, &value);
+
+    error = ___slim_machine_push(machine, value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, found);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_hput(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("HPUT\n");
+
+    u64_t key;
+    u64_t value;
+    u64_t handle;
+    u8_t inserted;
+    SlimTable* table;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &key);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &value);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &handle);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_table(machine, handle, &table);
+    slim_machine_except(machine, error);
+
+    error = slim_table_put(table, key, value, &inserted);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, inserted);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_hdel(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("HDEL\n");
+
+    u64_t key;
+    u64_t handle;
+    SlimTable* table;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &key);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_pop(machine, &handle);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_table(machine, handle, &table);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, slim_table_delete(table, key));
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_hlen(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("HLEN\n");
+
+    u64_t handle;
+    SlimTable* table;
+    SlimError error;
+
+    error = ___slim_machine_pop(machine, &handle);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_table(machine, handle, &table);
+    slim_machine_except(machine, error);
+
+    error = ___slim_machine_push(machine, table->count);
+    slim_machine_except(machine, error);
+
+    return;
+}
+
+void slim_routine_jmpx(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("JMPX %d\n", instruction.arg1);
+
+    // Loading a function rewrites its JMPX, so one that runs was never linked
+    SlimError error = SL_ERROR_LINK;
+    slim_machine_except(machine, error);
+}
+
+void slim_routine_lazy(SlimMachine* machine, SlimInstruction instruction) {
+    slim_print("LAZY %d\n", instruction.arg1);
+
+    u32_t address = machine->instruction_pointer - SLIM_INSTRUCTION_SIZE;
+    SlimError error = machine->image == NULL ? SL_ERROR_LINK : SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    // The function is found by address, another thread may have loaded it since the fetch. One that fails to load
+    // stops the machine, running on would execute the unloaded body behind it
+    error = slim_image_load(machine->image, address);
+    machine->flags.halt |= error != SL_ERROR_NONE;
+    slim_machine_except(machine, error);
+
+    // Run the first instruction of the function now that it is loaded
+    machine->instruction_pointer = address;
+    if (machine->traces) {
+        slim_trace_cache_flush(machine->traces);
+    }
+
+    return;
+}
+
+// Pairs with the release in slim_image_load, a cleared bit means the whole function body is visible
+static u8_t slim_image_pending(const SlimImage* image, u32_t address) {
+    u32_t index = address / SLIM_INSTRUCTION_SIZE;
+    if (address % SLIM_INSTRUCTION_SIZE != 0 || index >= image->size / SLIM_INSTRUCTION_SIZE) {
+        return 0;
+    }
+
+    return __atomic_load_n(&image->pending[index / 64], __ATOMIC_ACQUIRE) >> (index % 64) & 1;
+}
+
+// Fetch, Decode, Execute ----------------------------------------------------------------------------------------------
+SlimInstruction slim_machine_fetch(SlimMachine* machine) {
+    SlimInstruction instruction;
+    u32_t address = machine->instruction_pointer;
+    if (machine->image && slim_image_pending(machine->image, address)) {
+        // Unloaded functions are never read, their pages stay untouched until the load
+        instruction = (SlimInstruction){SL_OPCODE_LAZY, address, 0};
+    } else {
+        instruction = slim_instruction_decode(machine->bytecode + address);
+    }
+
+    slim_print("Fetch: 0x%x 0x%x 0x%x\n", instruction.opcode, instruction.arg1, instruction.arg2);
+
+    machine->instruction_pointer += SLIM_INSTRUCTION_SIZE;
+
+    return instruction;
+}
+
+SlimRoutine slim_machine_decode(SlimMachine* machine, SlimInstruction instruction) {
+    switch (instruction.opcode) {
+    case SL_OPCODE_NOOP: return slim_routine_nop; break;
+    case SL_OPCODE_HALT: return slim_routine_halt; break;
+    case SL_OPCODE_LOADI: return slim_routine_loadi; break;
+    case SL_OPCODE_LOADR: return slim_routine_loadr; break;
+    case SL_OPCODE_LOADM: return slim_routine_loadm; break;
+    case SL_OPCODE_DROP: return slim_routine_drop; break;
+    case SL_OPCODE_STORER: return slim_routine_storer; break;
+    case SL_OPCODE_STOREM: return slim_routine_storem; break;
+    case SL_OPCODE_DUP: return slim_routine_dup; break;
+    case SL_OPCODE_SWAP: return slim_routine_swap; break;
+    case SL_OPCODE_ROT: return slim_routine_rot; break;
+    case SL_OPCODE_ADD: return slim_routine_add; break;
+    case SL_OPCODE_SUB: return slim_routine_sub; break;
+    case SL_OPCODE_MUL: return slim_routine_mul; break;
+    case SL_OPCODE_DIV: return slim_routine_div; break;
+    case SL_OPCODE_ADDF: return slim_routine_addf; break;
+    case SL_OPCODE_SUBF: return slim_routine_subf; break;
+    case SL_OPCODE_MULF: return slim_routine_mulf; break;
+    case SL_OPCODE_DIVF: return slim_routine_divf; break;
+    case SL_OPCODE_ALLOC: return slim_routine_alloc; break;
+    case SL_OPCODE_FREE: return slim_routine_free; break;
+    case SL_OPCODE_JMP: return slim_routine_jmp; break;
+    case SL_OPCODE_JNE: return slim_routine_jne; break;
+    case SL_OPCODE_JE: return slim_routine_je; break;
+    case SL_OPCODE_NATIVE: return slim_routine_native; break;
+    case SL_OPCODE_NATIVEM: return slim_routine_nativem; break;
+    case SL_OPCODE_SEND: return slim_routine_send; break;
+    case SL_OPCODE_RECV: return slim_routine_recv; break;
+    case SL_OPCODE_TRYRECV: return slim_routine_tryrecv; break;
+    case SL_OPCODE_SENDM: return slim_routine_sendm; break;
+    case SL_OPCODE_RECVM: return slim_routine_recvm; break;
+    case SL_OPCODE_SPAWN: return slim_routine_spawn; break;
+    case SL_OPCODE_JOIN: return slim_routine_join; break;
+    case SL_OPCODE_LOADM_ACQ: return slim_routine_loadm_acq; break;
+    case SL_OPCODE_STOREM_REL: return slim_routine_storem_rel; break;
+    case SL_OPCODE_CAS: return slim_routine_cas; break;
+    case SL_OPCODE_FETCH_ADD: return slim_routine_fetch_add; break;
+    case SL_OPCODE_XCHG: return slim_routine_xchg; break;
+    case SL_OPCODE_SALLOC: return slim_routine_salloc; break;
+    case SL_OPCODE_SFREE: return slim_routine_sfree; break;
+    case SL_OPCODE_READ: return slim_routine_read; break;
+    case SL_OPCODE_READLINE: return slim_routine_readline; break;
+    case SL_OPCODE_PEEK: return slim_routine_peek; break;
+    case SL_OPCODE_WRITE: return slim_routine_write; break;
+    case SL_OPCODE_WRITEW: return slim_routine_writew; break;
+    case SL_OPCODE_HNEW: return slim_routine_hnew; break;
+    case SL_OPCODE_HGET: return slim_routine_hget; break;
+    case SL_OPCODE_HPUT: return slim_routine_hput; break;
+    case SL_OPCODE_HDEL: return slim_routine_hdel; break;
+    case SL_OPCODE_HLEN: return slim_routine_hlen; break;
+    case SL_OPCODE_JMPX: return slim_routine_jmpx; break;
+    case SL_OPCODE_LAZY: return slim_routine_lazy; break;
+    default: return NULL; break;
+    }
+}
+
+void slim_machine_execute(SlimMachine* machine, SlimRoutine routine, SlimInstruction instruction) {
+    if (routine) {
+        routine(machine, instruction);
+    } else {
+        printf("Invalid instruction\n");
+        machine->flags.error = 1;
+    }
+}
+// External API --------------------------------------------------------------------------------------------------------
+SlimMachine* slim_machine_create() {
+    // Zeroed, so a new machine starts out in the same state a clear leaves behind
+    SlimMachine* machine = calloc(1, sizeof(SlimMachine));
+    if (machine == NULL) {
+        return NULL;
+    }
+
+    machine->bytecode = NULL;
+    machine->bytecode_size = 0;
+    machine->entry = NULL;
+    machine->object = NULL;
+    machine->blocks = slim_block_create(0, SLIM_MACHINE_MEMORY_SIZE);
+    machine->traces = slim_trace_cache_create();
+    for (u32_t i = 0; i < SLIM_MACHINE_NATIVES; i++) {
+        machine->natives[i].function = NULL;
+        machine->natives[i].arity = 0;
+    }
+    return machine;
+}
+
+// Children nobody joined are waited for and thrown away
+static void slim_machine_discard_children(SlimMachine* machine) {
+    for (u32_t i = 0; i < machine->child_count; i++) {
+        slim_machine_release_child(slim_machine_reap(machine, machine->children[i]));
+        machine->children[i] = NULL;
+    }
+    machine->child_count = 0;
+}
+
+static void slim_machine_discard_tables(SlimMachine* machine) {
+    for (u32_t i = 0; i < SLIM_MACHINE_TABLES; i++) {
+        if (machine->tables[i]) {
+            slim_table_destroy(machine->tables[i]);
+            machine->tables[i] = NULL;
+        }
+    }
+}
+
+void slim_machine_destroy(SlimMachine* machine) {
+    slim_machine_discard_children(machine);
+    slim_machine_discard_tables(machine);
+    slim_machine_map_segment(machine, NULL);
+
+    // A linked image belongs to whoever linked it
+    if (machine->bytecode && machine->image == NULL) {
+        free(machine->bytecode);
+    }
+
+    if (machine->object) {
+        dlclose(machine->object);
+    }
+
+    slim_block_destroy(machine->blocks);
+
+    if (machine->traces) {
+        slim_trace_cache_destroy(machine->traces);
+    }
+
+    free(machine);
+}
+
+// Only what the previous run touched is cleared: popped stack slots are already zero and memory is cleared up to the
+// high-water mark
+void slim_machine_clear(SlimMachine* machine) {
+    slim_machine_discard_children(machine);
+    slim_machine_discard_tables(machine);
+
+    for (u32_t i = 0; i < machine->stack_pointer && i < SLIM_MACHINE_STACK_SIZE; i++) {
+        machine->stack[i] = 0;
+    }
+
+    for (u32_t i = 0; i < SLIM_MACHINE_REGISTERS; i++) {
+        machine->registers[i] = 0;
+    }
+
+    for (u32_t i = 0; i < machine->memory_high; i++) {
+        machine->memory[i] = 0;
+    }
+    machine->memory_high = 0;
+
+    // Reset Flags
+    machine->flags.zero = 0;
+    machine->flags.carry = 0;
+    machine->flags.overflow = 0;
+    machine->flags.negative = 0;
+    machine->flags.interrupt = 0;
+    machine->flags.decimal = 0;
+    machine->flags.error = 0;
+    machine->flags.halt = 0;
+    machine->flags.wait = 0;
+
+    // Reset Pointers
+    machine->stack_pointer = 0;
+    machine->instruction_pointer = 0;
+    machine->blocked = NULL;
+
+    // Reset Blocks
+    slim_block_reset(machine->blocks, SLIM_MACHINE_MEMORY_SIZE);
+
+    // Counters describe a single run, hosts keeping totals merge them before clearing
+    memset(&machine->stats, 0, sizeof(machine->stats));
+}
+
+// Hosts writing to memory directly must report it, otherwise the next clear won't see the write
+void slim_machine_mark_dirty(SlimMachine* machine, u32_t address, u32_t length) {
+    u32_t end = address + length;
+    if (end > SLIM_MACHINE_MEMORY_SIZE || end < address) {
+        end = SLIM_MACHINE_MEMORY_SIZE;
+    }
+
+    if (end > machine->memory_high) {
+        machine->memory_high = end;
+    }
+}
+
+void slim_machine_load(SlimMachine* machine, u8_t* data, u32_t size) {
+    u8_t changed = machine->bytecode != data || machine->bytecode_size != size;
+
+    // Children run the bytecode and object shared with them, so they finish before either goes away
+    if (changed) {
+        slim_machine_discard_children(machine);
+    }
+
+    // Traces are only valid for the bytecode they were recorded from
+    if (machine->traces && changed) {
+        slim_trace_cache_flush(machine->traces);
+    }
+
+    // So are compiled objects
+    if (changed) {
+        machine->bytecode_hashed = 0;
+
+        if (machine->object) {
+            dlclose(machine->object);
+            machine->object = NULL;
+        }
+        machine->entry = NULL;
+    }
+
+    if (machine->image && machine->image->data != data) {
+        machine->image = NULL;
+    }
+
+    machine->bytecode = data;
+    machine->bytecode_size = size;
+}
+
+// Hashed once per loaded bytecode and kept across reloads of the same buffer, like traces
+static u64_t ___slim_machine_bytecode_hash(SlimMachine* machine) {
+    if (!machine->bytecode_hashed) {
+        machine->bytecode_hash = slim_bytecode_hash(machine->bytecode, machine->bytecode_size);
+        machine->bytecode_hashed = 1;
+    }
+    return machine->bytecode_hash;
+}
+
+// Binds a shared object produced by slim-aot, the loaded bytecode is then only used for its size
+SlimError slim_machine_load_object(SlimMachine* machine, const char* filename) {
+    void* object = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (object == NULL) {
+        printf("Failed to open object: %s\n", dlerror());
+        return SL_ERROR_OBJECT_LOAD;
+    }
+
+    SlimEntry entry = (SlimEntry)dlsym(object, SLIM_AOT_ENTRY);
+    if (entry == NULL) {
+        printf("Missing entry point: %s\n", SLIM_AOT_ENTRY);
+        dlclose(object);
+        return SL_ERROR_OBJECT_LOAD;
+    }
+
+    // Compiled code jumps by address, so it must have been generated from exactly the loaded bytecode
+    const u64_t* hash = dlsym(object, SLIM_AOT_HASH);
+    const u32_t* size = dlsym(object, SLIM_AOT_SIZE);
+    if (hash == NULL || size == NULL || machine->bytecode == NULL || *size != machine->bytecode_size ||
+        *hash != ___slim_machine_bytecode_hash(machine)) {
+        printf("Object does not match the loaded bytecode\n");
+        dlclose(object);
+        return SL_ERROR_OBJECT_LOAD;
+    }
+
+    if (machine->object) {
+        dlclose(machine->object);
+    }
+
+    machine->object = object;
+    machine->entry = entry;
+
+    return SL_ERROR_NONE;
+}
+
+SlimError slim_machine_register_native(SlimMachine* machine, u32_t index, SlimNative function, u32_t arity) {
+    if (index >= SLIM_MACHINE_NATIVES) {
+        return SL_ERROR_INVALID_NATIVE;
+    }
+
+    if (arity > SLIM_MACHINE_STACK_SIZE) {
+        return SL_ERROR_STACK_OVERFLOW;
+    }
+
+    machine->natives[index].function = function;
+    machine->natives[index].arity = arity;
+
+    // Recorded traces baked in the previous arity
+    if (machine->traces) {
+        slim_trace_cache_flush(machine->traces);
+    }
+
+    return SL_ERROR_NONE;
+}
+
+SlimError slim_machine_attach_channel(SlimMachine* machine, u32_t index, SlimChannel* channel) {
+    if (index >= SLIM_MACHINE_CHANNELS) {
+        return SL_ERROR_INVALID_CHANNEL;
+    }
+
+    machine->channels[index] = channel;
+    return SL_ERROR_NONE;
+}
+
+// Sleeps until the channel a waiting machine stopped on has made progress, launch it again afterwards
+void slim_machine_park(SlimMachine* machine) {
+    if (!machine->flags.wait || machine->blocked == NULL) {
+        sched_yield();
+        return;
+    }
+
+    slim_channel_park(machine->blocked, machine->blocked_count, machine->blocked_send);
+}
+
+void slim_machine_attach_scheduler(SlimMachine* machine, SlimScheduler* scheduler) {
+    machine->scheduler = scheduler;
+}
+
+SlimError slim_machine_attach_stream(SlimMachine* machine, u32_t index, SlimStream* stream) {
+    if (index >= SLIM_MACHINE_STREAMS) {
+        return SL_ERROR_STREAM;
+    }
+
+    machine->streams[index] = stream;
+    return SL_ERROR_NONE;
+}
+
+void slim_machine_load_image(SlimMachine* machine, SlimImage* image) {
+    slim_machine_load(machine, image->data, image->size);
+    machine->image = image;
+}
+
+// Cached blocks go back to the segment they came from before the mapping changes
+void slim_machine_map_segment(SlimMachine* machine, SlimSegment* segment) {
+    if (machine->segment_cache) {
+        slim_segment_flush(machine->segment, machine->segment_cache);
+        free(machine->segment_cache);
+        machine->segment_cache = NULL;
+    }
+
+    machine->segment = segment;
+}
+
+static void slim_machine_stopped(SlimMachine* machine) {
+    if (machine->flags.halt) {
+        slim_print("Machine halted\n");
+    } else {
+        slim_print("Machine waiting\n");
+    }
+}
+
+// Runs until the machine halts or has to wait on a channel, a waiting machine picks up where it left off
+void slim_machine_launch(SlimMachine* machine) {
+    machine->flags.wait = 0;
+
+    // Compiled code returns whenever control leaves its static flow, so just re-enter it
+    if (machine->entry) {
+        while (machine->flags.halt == 0 && machine->flags.wait == 0) {
+            machine->entry(machine);
+        }
+        slim_machine_stopped(machine);
+        return;
+    }
+
+    while (machine->flags.halt == 0 && machine->flags.wait == 0) {
+        // A cached trace runs silently in its own loop, it only hands back once a guard fails
+        if (machine->traces && !machine->traces->recording) {
+            SlimTrace* trace = slim_trace_lookup(machine->traces, machine->instruction_pointer);
+            if (trace != NULL && slim_trace_run(machine, trace) > 0) {
+                continue;
+            }
+        }
+
+        // The error flag is sticky, recording only needs to know whether this instruction raised it
+        u8_t error = machine->flags.error;
+        machine->flags.error = 0;
+
+        u32_t address = machine->instruction_pointer;
+        SlimInstruction instruction = slim_machine_fetch(machine);
+        SlimRoutine routine = slim_machine_decode(machine, instruction);
+        slim_machine_execute(machine, routine, instruction);
+        machine->stats.instructions += !machine->flags.wait;
+        slim_trace_observe(machine, address, instruction);
+        machine->flags.error |= error;
+    }
+    slim_machine_stopped(machine);
+}
+// Channels ------------------------------------------------------------------------------------------------------------
+SlimChannel* slim_channel_create(u32_t capacity, SlimChannelMode mode) {
+    // Positions wrap with a mask, so the capacity is rounded up to a power of two
+    u32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    SlimChannel* channel = aligned_alloc(64, sizeof(SlimChannel));
+    if (channel == NULL) {
+        return NULL;
+    }
+
+    channel->mode = mode;
+    channel->capacity = size;
+    channel->values = malloc(sizeof(u64_t) * size);
+    channel->sequences = NULL;
+    atomic_init(&channel->head, 0);
+    atomic_init(&channel->tail, 0);
+    atomic_init(&channel->sleepers, 0);
+    pthread_mutex_init(&channel->lock, NULL);
+    pthread_cond_init(&channel->progress, NULL);
+
+    if (mode == SL_CHANNEL_MPSC) {
+        channel->sequences = malloc(sizeof(_Atomic u64_t) * size);
+        if (channel->sequences != NULL) {
+            for (u32_t i = 0; i < size; i++) {
+                atomic_init(&channel->sequences[i], i);
+            }
+        }
+    }
+
+    if (channel->values == NULL || (mode == SL_CHANNEL_MPSC && channel->sequences == NULL)) {
+        slim_channel_destroy(channel);
+        return NULL;
+    }
+
+    return channel;
+}
+
+void slim_channel_destroy(SlimChannel* channel) {
+    pthread_mutex_destroy(&channel->lock);
+    pthread_cond_destroy(&channel->progress);
+    free(channel->values);
+    free((void*)channel->sequences);
+    free(channel);
+}
+
+static u32_t slim_channel_send_spsc(SlimChannel* channel, const u64_t* values, u32_t count) {
+    u64_t tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    u64_t head = atomic_load_explicit(&channel->head, memory_order_acquire);
+    if (channel->capacity - (tail - head) < count) {
+        return 0;
+    }
+
+    u64_t mask = channel->capacity - 1;
+    for (u32_t i = 0; i < count; i++) {
+        channel->values[(tail + i) & mask] = values[i];
+    }
+
+    // A single release publishes the whole batch
+    atomic_store_explicit(&channel->tail, tail + count, memory_order_release);
+    return count;
+}
+
+static u32_t slim_channel_receive_spsc(SlimChannel* channel, u64_t* values, u32_t count) {
+    u64_t head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    u64_t tail = atomic_load_explicit(&channel->tail, memory_order_acquire);
+    if (tail - head < count) {
+        return 0;
+    }
+
+    u64_t mask = channel->capacity - 1;
+    for (u32_t i = 0; i < count; i++) {
+        values[i] = channel->values[(head + i) & mask];
+    }
+
+    atomic_store_explicit(&channel->head, head + count, memory_order_release);
+    return count;
+}
+
+// Producers claim a run of positions with one CAS on the tail. Slots are freed in order by the single consumer, so
+// the run is free once its last slot is.
+static u32_t slim_channel_send_mpsc(SlimChannel* channel, const u64_t* values, u32_t count) {
+    u64_t mask = channel->capacity - 1;
+    u64_t position = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+
+    for (;;) {
+        u64_t last = position + count - 1;
+        u64_t sequence = atomic_load_explicit(&channel->sequences[last & mask], memory_order_acquire);
+        s64_t difference = (s64_t)(sequence - last);
+
+        if (difference < 0) {
+            return 0;
+        }
+
+        if (difference > 0) {
+            position = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(
+                &channel->tail, &position, position + count, memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (u32_t i = 0; i < count; i++) {
+        channel->values[(position + i) & mask] = values[i];
+        atomic_store_explicit(&channel->sequences[(position + i) & mask], position + i + 1, memory_order_release);
+    }
+
+    return count;
+}
+
+static u32_t slim_channel_receive_mpsc(SlimChannel* channel, u64_t* values, u32_t count) {
+    u64_t mask = channel->capacity - 1;
+    u64_t head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+
+    // Producers may publish out of order, the batch is only taken once every slot of it is in
+    for (u32_t i = 0; i < count; i++) {
+        u64_t sequence = atomic_load_explicit(&channel->sequences[(head + i) & mask], memory_order_acquire);
+        if (sequence != head + i + 1) {
+            return 0;
+        }
+    }
+
+    for (u32_t i = 0; i < count; i++) {
+        values[i] = channel->values[(head + i) & mask];
+        atomic_store_explicit(
+            &channel->sequences[(head + i) & mask], head + i + channel->capacity, memory_order_release);
+    }
+
+    atomic_store_explicit(&channel->head, head + count, memory_order_relaxed);
+    return count;
+}
+
+// Pairs with the fence in slim_channel_park: either the sleeper sees this progress or this sees the sleeper
+static void slim_channel_notify(SlimChannel* channel) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&channel->sleepers, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    pthread_cond_broadcast(&channel->progress);
+    pthread_mutex_unlock(&channel->lock);
+}
+
+// Whether a batch of count might go through now, a stale answer only costs a retry
+static u8_t slim_channel_ready(SlimChannel* channel, u32_t count, u8_t send) {
+    u64_t mask = channel->capacity - 1;
+    u64_t head = atomic_load_explicit(&channel->head, memory_order_acquire);
+    u64_t tail = atomic_load_explicit(&channel->tail, memory_order_acquire);
+
+    if (channel->mode == SL_CHANNEL_SPSC) {
+        return send ? channel->capacity - (tail - head) >= count : tail - head >= count;
+    }
+
+    if (send) {
+        u64_t last = tail + count - 1;
+        u64_t sequence = atomic_load_explicit(&channel->sequences[last & mask], memory_order_acquire);
+        return (s64_t)(sequence - last) >= 0;
+    }
+
+    for (u32_t i = 0; i < count; i++) {
+        u64_t sequence = atomic_load_explicit(&channel->sequences[(head + i) & mask], memory_order_acquire);
+        if (sequence != head + i + 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+u32_t slim_channel_send(SlimChannel* channel, const u64_t* values, u32_t count) {
+    if (count == 0 || count > channel->capacity) {
+        return 0;
+    }
+
+    u32_t sent = channel->mode == SL_CHANNEL_MPSC ? slim_channel_send_mpsc(channel, values, count)
+                                                  : slim_channel_send_spsc(channel, values, count);
+    if (sent > 0) {
+        slim_channel_notify(channel);
+    }
+    return sent;
+}
+
+u32_t slim_channel_receive(SlimChannel* channel, u64_t* values, u32_t count) {
+    if (count == 0 || count > channel->capacity) {
+        return 0;
+    }
+
+    u32_t received = channel->mode == SL_CHANNEL_MPSC ? slim_channel_receive_mpsc(channel, values, count)
+                                                      : slim_channel_receive_spsc(channel, values, count);
+    if (received > 0) {
+        slim_channel_notify(channel);
+    }
+    return received;
+}
+
+// Sleeps until a send (or receive) of count could go through
+void slim_channel_park(SlimChannel* channel, u32_t count, u8_t send) {
+    if (count == 0 || count > channel->capacity) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&channel->sleepers, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    pthread_mutex_lock(&channel->lock);
+    while (!slim_channel_ready(channel, count, send)) {
+        pthread_cond_wait(&channel->progress, &channel->lock);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    atomic_fetch_sub_explicit(&channel->sleepers, 1, memory_order_relaxed);
+}
+// Scheduling ----------------------------------------------------------------------------------------------------------
+// The queue owned by the current thread, when it is one of the workers
+static _Thread_local SlimTaskQueue* slim_scheduler_own = NULL;
+
+static u8_t slim_task_queue_push(SlimTaskQueue* queue, SlimTask* task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail - queue->head == SLIM_SCHEDULER_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    queue->tasks[queue->tail++ % SLIM_SCHEDULER_QUEUE_SIZE] = task;
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+// The owner works from the bottom, most recently spawned first
+static SlimTask* slim_task_queue_pop(SlimTaskQueue* queue) {
+    SlimTask* task = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail != queue->head) {
+        task = queue->tasks[--queue->tail % SLIM_SCHEDULER_QUEUE_SIZE];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+// Thieves take from the top, the oldest and usually largest piece of work
+static SlimTask* slim_task_queue_steal(SlimTaskQueue* queue) {
+    SlimTask* task = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail != queue->head) {
+        task = queue->tasks[queue->head++ % SLIM_SCHEDULER_QUEUE_SIZE];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+static SlimTask* slim_scheduler_take(SlimScheduler* scheduler) {
+    SlimTask* task = NULL;
+    u32_t start = 0;
+
+    if (slim_scheduler_own != NULL && slim_scheduler_own->scheduler == scheduler) {
+        task = slim_task_queue_pop(slim_scheduler_own);
+        start = (u32_t)(slim_scheduler_own - scheduler->queues) + 1;
+    }
+
+    for (u32_t i = 0; task == NULL && i < scheduler->workers; i++) {
+        task = slim_task_queue_steal(&scheduler->queues[(start + i) % scheduler->workers]);
+    }
+
+    if (task != NULL) {
+        atomic_fetch_sub_explicit(&scheduler->queued, 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static void* slim_scheduler_work(void* argument) {
+    SlimTaskQueue* queue = argument;
+    SlimScheduler* scheduler = queue->scheduler;
+    slim_scheduler_own = queue;
+
+    for (;;) {
+        SlimTask* task = slim_scheduler_take(scheduler);
+        if (task != NULL) {
+            slim_task_run(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        while (atomic_load(&scheduler->queued) == 0 && !atomic_load(&scheduler->stopping)) {
+            pthread_cond_wait(&scheduler->available, &scheduler->lock);
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+
+        if (atomic_load(&scheduler->stopping) && atomic_load(&scheduler->queued) == 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+SlimScheduler* slim_scheduler_create(u32_t workers) {
+    SlimScheduler* scheduler = malloc(sizeof(SlimScheduler));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+
+    if (workers == 0) {
+        workers = 1;
+    }
+
+    scheduler->workers = workers;
+    scheduler->threads = malloc(sizeof(pthread_t) * workers);
+    scheduler->queues = malloc(sizeof(SlimTaskQueue) * workers);
+    if (scheduler->threads == NULL || scheduler->queues == NULL) {
+        free(scheduler->threads);
+        free(scheduler->queues);
+        free(scheduler);
+        return NULL;
+    }
+
+    atomic_init(&scheduler->queued, 0);
+    atomic_init(&scheduler->next, 0);
+    atomic_init(&scheduler->stopping, 0);
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->available, NULL);
+
+    for (u32_t i = 0; i < workers; i++) {
+        scheduler->queues[i].scheduler = scheduler;
+        scheduler->queues[i].head = 0;
+        scheduler->queues[i].tail = 0;
+        pthread_mutex_init(&scheduler->queues[i].lock, NULL);
+    }
+
+    for (u32_t i = 0; i < workers; i++) {
+        pthread_create(&scheduler->threads[i], NULL, slim_scheduler_work, &scheduler->queues[i]);
+    }
+
+    return scheduler;
+}
+
+// Workers drain whatever is still queued before they exit
+void slim_scheduler_destroy(SlimScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    atomic_store(&scheduler->stopping, 1);
+    pthread_cond_broadcast(&scheduler->available);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (u32_t i = 0; i < scheduler->workers; i++) {
+        pthread_join(scheduler->threads[i], NULL);
+    }
+
+    for (u32_t i = 0; i < scheduler->workers; i++) {
+        pthread_mutex_destroy(&scheduler->queues[i].lock);
+    }
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->available);
+
+    free(scheduler->threads);
+    free(scheduler->queues);
+    free(scheduler);
+}
+
+void slim_scheduler_submit(SlimScheduler* scheduler, SlimTask* task) {
+    SlimTaskQueue* queue = slim_scheduler_own;
+    if (queue == NULL || queue->scheduler != scheduler) {
+        u32_t next = atomic_fetch_add_explicit(&scheduler->next, 1, memory_order_relaxed);
+        queue = &scheduler->queues[next % scheduler->workers];
+    }
+
+    // A full queue means there is plenty of parallel work already, just run it here
+    if (!slim_task_queue_push(queue, task)) {
+        slim_task_run(task);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&scheduler->queued, 1, memory_order_relaxed);
+    pthread_mutex_lock(&scheduler->lock);
+    pthread_cond_signal(&scheduler->available);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+// Runs other queued tasks while the awaited one is still in flight, sleeps when there are none
+void slim_scheduler_wait(SlimScheduler* scheduler, SlimTask* task) {
+    while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+        SlimTask* other = slim_scheduler_take(scheduler);
+        if (other != NULL) {
+            slim_task_run(other);
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler->lock);
+        while (!atomic_load_explicit(&task->done, memory_order_acquire) && atomic_load(&scheduler->queued) == 0) {
+            pthread_cond_wait(&scheduler->available, &scheduler->lock);
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+void slim_task_run(SlimTask* task) {
+    SlimMachine* machine = task->machine;
+    SlimScheduler* scheduler = machine->scheduler;
+
+    while (machine->flags.halt == 0) {
+        slim_machine_launch(machine);
+        if (!machine->flags.wait) {
+            continue;
+        }
+
+        // On a worker, whatever is queued may be the peer the channel is waiting for
+        SlimTask* other = scheduler && slim_scheduler_own ? slim_scheduler_take(scheduler) : NULL;
+        if (other != NULL) {
+            slim_task_run(other);
+        } else {
+            slim_machine_park(machine);
+        }
+    }
+
+    atomic_store_explicit(&task->done, 1, memory_order_release);
+    if (scheduler) {
+        pthread_mutex_lock(&scheduler->lock);
+        pthread_cond_broadcast(&scheduler->available);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+// Shared Memory -------------------------------------------------------------------------------------------------------
+SlimSegment* slim_segment_create(u32_t size) {
+    SlimSegment* segment = malloc(sizeof(SlimSegment));
+    if (segment == NULL) {
+        return NULL;
+    }
+
+    segment->words = malloc(sizeof(_Atomic u64_t) * size);
+    segment->classes = malloc(size);
+    if (segment->words == NULL || segment->classes == NULL) {
+        free((void*)segment->words);
+        free(segment->classes);
+        free(segment);
+        return NULL;
+    }
+
+    for (u32_t i = 0; i < size; i++) {
+        atomic_init(&segment->words[i], 0);
+    }
+    memset(segment->classes, 0xFF, size);
+
+    segment->size = size;
+    segment->bump = 0;
+    for (u32_t i = 0; i < SLIM_SEGMENT_CLASSES; i++) {
+        segment->free[i] = SLIM_SEGMENT_NULL;
+    }
+    pthread_mutex_init(&segment->lock, NULL);
+
+    return segment;
+}
+
+void slim_segment_destroy(SlimSegment* segment) {
+    pthread_mutex_destroy(&segment->lock);
+    free((void*)segment->words);
+    free(segment->classes);
+    free(segment);
+}
+
+// Free blocks are linked through their first word, callers hold the lock
+static void slim_segment_push(SlimSegment* segment, u32_t class, u32_t address) {
+    atomic_store_explicit(&segment->words[address], segment->free[class], memory_order_relaxed);
+    segment->free[class] = address;
+}
+
+static u32_t slim_segment_pop(SlimSegment* segment, u32_t class) {
+    u32_t address = segment->free[class];
+    if (address != SLIM_SEGMENT_NULL) {
+        segment->free[class] = (u32_t)atomic_load_explicit(&segment->words[address], memory_order_relaxed);
+    } else if (segment->size - segment->bump >= (1u << class)) {
+        address = segment->bump;
+        segment->classes[address] = class;
+        segment->bump += 1u << class;
+    }
+    return address;
+}
+
+SlimError slim_segment_alloc(SlimSegment* segment, SlimSegmentCache* cache, u32_t size, u32_t* address) {
+    u32_t class = 0;
+    while (class < SLIM_SEGMENT_CLASSES && (1u << class) < size) {
+        class++;
+    }
+
+    if (class == SLIM_SEGMENT_CLASSES) {
+        return SL_ERROR_SEGMENT;
+    }
+
+    u32_t block = SLIM_SEGMENT_NULL;
+    if (cache != NULL && cache->count[class] > 0) {
+        block = cache->blocks[class][--cache->count[class]];
+    } else {
+        // Take half a cache worth while holding the lock anyway
+        pthread_mutex_lock(&segment->lock);
+        block = slim_segment_pop(segment, class);
+        while (cache != NULL && block != SLIM_SEGMENT_NULL && cache->count[class] < SLIM_SEGMENT_CACHE_SIZE / 2 &&
+               segment->free[class] != SLIM_SEGMENT_NULL) {
+            cache->blocks[class][cache->count[class]++] = slim_segment_pop(segment, class);
+        }
+        pthread_mutex_unlock(&segment->lock);
+    }
+
+    if (block == SLIM_SEGMENT_NULL) {
+        return SL_ERROR_SEGMENT;
+    }
+
+    // Fresh blocks from the bump pointer are still zero, freed ones hold a free list link and their last owner's words
+    u8_t reused = __atomic_exchange_n(&segment->classes[block], class, __ATOMIC_RELAXED) & SLIM_SEGMENT_FREED;
+    for (u32_t i = 0; reused && i < (1u << class); i++) {
+        atomic_store_explicit(&segment->words[block + i], 0, memory_order_relaxed);
+    }
+    *address = block;
+    return SL_ERROR_NONE;
+}
+
+SlimError slim_segment_free(SlimSegment* segment, SlimSegmentCache* cache, u32_t address) {
+    if (address >= segment->size) {
+        return SL_ERROR_INVALID_ADDRESS;
+    }
+
+    // Marking the block free doubles as the check that it was not free already
+    u8_t class = __atomic_fetch_or(&segment->classes[address], SLIM_SEGMENT_FREED, __ATOMIC_RELAXED);
+    if (class >= SLIM_SEGMENT_CLASSES) {
+        return SL_ERROR_INVALID_ADDRESS;
+    }
+
+    if (cache == NULL) {
+        pthread_mutex_lock(&segment->lock);
+        slim_segment_push(segment, class, address);
+        pthread_mutex_unlock(&segment->lock);
+        return SL_ERROR_NONE;
+    }
+
+    if (cache->count[class] == SLIM_SEGMENT_CACHE_SIZE) {
+        pthread_mutex_lock(&segment->lock);
+        while (cache->count[class] > SLIM_SEGMENT_CACHE_SIZE / 2) {
+            slim_segment_push(segment, class, cache->blocks[class][--cache->count[class]]);
+        }
+        pthread_mutex_unlock(&segment->lock);
+    }
+
+    cache->blocks[class][cache->count[class]++] = address;
+    return SL_ERROR_NONE;
+}
+
+void slim_segment_flush(SlimSegment* segment, SlimSegmentCache* cache) {
+    pthread_mutex_lock(&segment->lock);
+    for (u32_t class = 0; class < SLIM_SEGMENT_CLASSES; class++) {
+        while (cache->count[class] > 0) {
+            slim_segment_push(segment, class, cache->blocks[class][--cache->count[class]]);
+        }
+    }
+    pthread_mutex_unlock(&segment->lock);
+}
+// Streams -------------------------------------------------------------------------------------------------------------
+SlimStream* slim_stream_open(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    SlimStream* stream = calloc(1, sizeof(SlimStream));
+    if (stream == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    // An empty file can't be mapped, it simply reads as end of input
+    stream->fd = -1;
+    stream->size = (u64_t)info.st_size;
+    if (stream->size > 0) {
+        void* window = mmap(NULL, stream->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (window == MAP_FAILED) {
+            close(fd);
+            free(stream);
+            return NULL;
+        }
+
+        madvise(window, stream->size, MADV_SEQUENTIAL);
+        stream->window = window;
+    }
+
+    // The mapping keeps the file alive on its own
+    close(fd);
+    return stream;
+}
+
+SlimStream* slim_stream_create(int fd, u32_t capacity) {
+    SlimStream* stream = calloc(1, sizeof(SlimStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    stream->fd = fd;
+    stream->capacity = capacity ? capacity : SLIM_STREAM_BUFFER_SIZE;
+    stream->buffer = malloc(stream->capacity);
+    if (stream->buffer == NULL) {
+        free(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+void slim_stream_destroy(SlimStream* stream) {
+    if (stream->buffer) {
+        slim_stream_flush(stream);
+        free(stream->buffer);
+    }
+
+    if (stream->window) {
+        munmap((void*)stream->window, stream->size);
+    }
+
+    free(stream);
+}
+
+static SlimError slim_write_all(int fd, const u8_t* data, u64_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return SL_ERROR_STREAM;
+        }
+
+        data += written;
+        length -= (u64_t)written;
+    }
+
+    return SL_ERROR_NONE;
+}
+
+SlimError slim_stream_write(SlimStream* stream, const u8_t* data, u64_t length) {
+    if (stream->buffer == NULL) {
+        return SL_ERROR_STREAM;
+    }
+
+    if (length > stream->capacity - stream->length) {
+        SlimError error = slim_stream_flush(stream);
+        if (error != SL_ERROR_NONE) {
+            return error;
+        }
+
+        // Copying something at least a buffer long would only add a pass over it
+        if (length >= stream->capacity) {
+            return slim_write_all(stream->fd, data, length);
+        }
+    }
+
+    memcpy(stream->buffer + stream->length, data, length);
+    stream->length += (u32_t)length;
+    return SL_ERROR_NONE;
+}
+
+SlimError slim_stream_flush(SlimStream* stream) {
+    if (stream->buffer == NULL) {
+        return SL_ERROR_STREAM;
+    }
+
+    SlimError error = slim_write_all(stream->fd, stream->buffer, stream->length);
+    stream->length = 0;
+    return error;
+}
+
+// Hash Tables ---------------------------------------------------------------------------------------------------------
+#define SLIM_TABLE_EMPTY 0x80
+#define SLIM_TABLE_DELETED 0xFE
+#define SLIM_TABLE_MISSING 0xFFFFFFFF
+
+// Keys are often small sequential integers, mix them before splitting into group index and control byte
+static u64_t slim_table_hash(u64_t key) {
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+// Bit i is set when control byte i of the group equals byte
+static u32_t slim_table_match(const u8_t* group, u8_t byte) {
+#if defined(__SSE2__)
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (u32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+#else
+    u32_t mask = 0;
+    for (u32_t i = 0; i < SLIM_TABLE_GROUP; i++) {
+        mask |= (u32_t)(group[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+// EMPTY and DELETED are the only control bytes with the high bit set
+static u32_t slim_table_match_free(const u8_t* group) {
+#if defined(__SSE2__)
+    return (u32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    u32_t mask = 0;
+    for (u32_t i = 0; i < SLIM_TABLE_GROUP; i++) {
+        mask |= (u32_t)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+// Triangular steps over a power of two number of groups visit every group once
+static u32_t slim_table_find(SlimTable* table, u64_t key, u64_t hash) {
+    u32_t mask = table->capacity / SLIM_TABLE_GROUP - 1;
+    u32_t group = (u32_t)(hash >> 7) & mask;
+
+    for (u32_t step = 1; step <= mask + 1; step++) {
+        const u8_t* control = table->control + group * SLIM_TABLE_GROUP;
+        u32_t matches = slim_table_match(control, hash & 0x7F);
+        while (matches) {
+            u32_t slot = group * SLIM_TABLE_GROUP + (u32_t)__builtin_ctz(matches);
+            if (table->keys[slot] == key) {
+                return slot;
+            }
+            matches &= matches - 1;
+        }
+
+        // A key is never placed past a group that still has an empty slot
+        if (slim_table_match(control, SLIM_TABLE_EMPTY)) {
+            return SLIM_TABLE_MISSING;
+        }
+
+        group = (group + step) & mask;
+    }
+
+    return SLIM_TABLE_MISSING;
+}
+
+static u32_t slim_table_find_free(SlimTable* table, u64_t hash) {
+    u32_t mask = table->capacity / SLIM_TABLE_GROUP - 1;
+    u32_t group = (u32_t)(hash >> 7) & mask;
+
+    // The load factor keeps at least one empty slot, so this always ends
+    for (u32_t step = 1;; step++) {
+        u32_t free = slim_table_match_free(table->control + group * SLIM_TABLE_GROUP);
+        if (free) {
+            return group * SLIM_TABLE_GROUP + (u32_t)__builtin_ctz(free);
+        }
+
+        group = (group + step) & mask;
+    }
+}
+
+static u32_t slim_table_limit(u32_t capacity) {
+    return capacity - capacity / 8;
+}
+
+static SlimError slim_table_allocate(SlimTable* table, u32_t capacity) {
+    table->control = malloc(capacity);
+    table->keys = malloc(sizeof(u64_t) * capacity);
+    table->values = malloc(sizeof(u64_t) * capacity);
+    if (table->control == NULL || table->keys == NULL || table->values == NULL) {
+        free(table->control);
+        free(table->keys);
+        free(table->values);
+        return SL_ERROR_TABLE;
+    }
+
+    memset(table->control, SLIM_TABLE_EMPTY, capacity);
+    table->capacity = capacity;
+    table->count = 0;
+    table->deleted = 0;
+    return SL_ERROR_NONE;
+}
+
+SlimTable* slim_table_create(u32_t capacity) {
+    u32_t slots = SLIM_TABLE_GROUP;
+    while (slim_table_limit(slots) < capacity) {
+        if (slots >= 1u << 30) {
+            return NULL;
+        }
+        slots *= 2;
+    }
+
+    SlimTable* table = malloc(sizeof(SlimTable));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    if (slim_table_allocate(table, slots) != SL_ERROR_NONE) {
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+void slim_table_destroy(SlimTable* table) {
+    free(table->control);
+    free(table->keys);
+    free(table->values);
+    free(table);
+}
+
+// Grows when live keys fill more than half, otherwise rebuilds in place to drop the tombstones
+static SlimError slim_table_rehash(SlimTable* table) {
+    SlimTable old = *table;
+    u32_t capacity = table->count >= old.capacity / 2 ? old.capacity * 2 : old.capacity;
+    if (capacity == 0) {
+        return SL_ERROR_TABLE;
+    }
+
+    if (slim_table_allocate(table, capacity) != SL_ERROR_NONE) {
+        *table = old;
+        return SL_ERROR_TABLE;
+    }
+
+    for (u32_t i = 0; i < old.capacity; i++) {
+        if (old.control[i] & 0x80) {
+            continue;
+        }
+
+        u64_t hash = slim_table_hash(old.keys[i]);
+        u32_t slot = slim_table_find_free(table, hash);
+        table->control[slot] = hash & 0x7F;
+        table->keys[slot] = old.keys[i];
+        table->values[slot] = old.values[i];
+        table->count++;
+    }
+
+    free(old.control);
+    free(old.keys);
+    free(old.values);
+    return SL_ERROR_NONE;
+}
+
+u8_t slim_table_get(SlimTable* table, u64_t key, u64_t* value) {
+    u32_t slot = slim_table_find(table, key, slim_table_hash(key));
+    if (slot == SLIM_TABLE_MISSING) {
+        return 0;
+    }
+
+    *value = table->values[slot];
+    return 1;
+}
+
+SlimError slim_table_put(SlimTable* table, u64_t key, u64_t value, u8_t* inserted) {
+    u64_t hash = slim_table_hash(key);
+    u32_t slot = slim_table_find(table, key, hash);
+    if (slot != SLIM_TABLE_MISSING) {
+        table->values[slot] = value;
+        *inserted = 0;
+        return SL_ERROR_NONE;
+    }
+
+    if (table->count + table->deleted + 1 > slim_table_limit(table->capacity)) {
+        SlimError error = slim_table_rehash(table);
+        if (error != SL_ERROR_NONE) {
+            return error;
+        }
+    }
+
+    slot = slim_table_find_free(table, hash);
+    if (table->control[slot] == SLIM_TABLE_DELETED) {
+        table->deleted--;
+    }
+
+    table->control[slot] = hash & 0x7F;
+    table->keys[slot] = key;
+    table->values[slot] = value;
+    table->count++;
+    *inserted = 1;
+    return SL_ERROR_NONE;
+}
+
+u8_t slim_table_delete(SlimTable* table, u64_t key) {
+    u32_t slot = slim_table_find(table, key, slim_table_hash(key));
+    if (slot == SLIM_TABLE_MISSING) {
+        return 0;
+    }
+
+    // Probes already stop at a group with an empty slot, so the slot can go back to empty instead of a tombstone
+    const u8_t* group = table->control + slot / SLIM_TABLE_GROUP * SLIM_TABLE_GROUP;
+    if (slim_table_match(group, SLIM_TABLE_EMPTY)) {
+        table->control[slot] = SLIM_TABLE_EMPTY;
+    } else {
+        table->control[slot] = SLIM_TABLE_DELETED;
+        table->deleted++;
+    }
+
+    table->count--;
+    return 1;
+}
+
+// Modules -------------------------------------------------------------------------------------------------------------
+#define SLIM_MODULE_HEADER_SIZE 20
+#define SLIM_MODULE_FUNCTION_SIZE (SLIM_MODULE_NAME_SIZE + 8)
+
+static u32_t slim_module_u32(const u8_t* data) {
+    return (u32_t)data[0] << 24 | (u32_t)data[1] << 16 | (u32_t)data[2] << 8 | (u32_t)data[3];
+}
+
+static SlimError slim_module_read(int fd, void* buffer, u64_t size, u64_t offset) {
+    u8_t* data = buffer;
+    while (size > 0) {
+        ssize_t count = pread(fd, data, size, offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count <= 0) {
+            return SL_ERROR_LINK;
+        }
+
+        data += count;
+        size -= (u64_t)count;
+        offset += (u64_t)count;
+    }
+
+    return SL_ERROR_NONE;
+}
+
+static u64_t slim_module_name_hash(const char* name) {
+    return slim_bytecode_hash((const u8_t*)name, (u32_t)strnlen(name, SLIM_MODULE_NAME_SIZE));
+}
+
+// Reads the header and tables of one module, the import names are handed back for resolution once all are read
+static SlimError slim_image_read_module(SlimImage* image, u32_t index, const char* filename, u64_t base, u8_t** names) {
+    SlimModule* module = &image->modules[index];
+    module->fd = open(filename, O_RDONLY);
+    if (module->fd < 0) {
+        printf("Failed to open module %s\n", filename);
+        return SL_ERROR_LINK;
+    }
+
+    u8_t header[SLIM_MODULE_HEADER_SIZE];
+    if (slim_module_read(module->fd, header, sizeof(header), 0) != SL_ERROR_NONE ||
+        slim_module_u32(header) != SLIM_MODULE_MAGIC || slim_module_u32(header + 4) != SLIM_VERSION) {
+        printf("Invalid module %s\n", filename);
+        return SL_ERROR_LINK;
+    }
+
+    u32_t function_count = slim_module_u32(header + 8);
+    u32_t import_count = slim_module_u32(header + 12);
+    u32_t code_size = slim_module_u32(header + 16);
+    u64_t table_size = (u64_t)function_count * SLIM_MODULE_FUNCTION_SIZE + (u64_t)import_count * SLIM_MODULE_NAME_SIZE;
+    if (function_count == 0 || code_size % SLIM_INSTRUCTION_SIZE != 0 || table_size > 1u << 30) {
+        printf("Invalid module %s\n", filename);
+        return SL_ERROR_LINK;
+    }
+
+    u8_t* tables = malloc(table_size ? table_size : 1);
+    SlimFunction* functions = realloc(image->functions, sizeof(SlimFunction) * (image->function_count + function_count));
+    module->imports = malloc(sizeof(u32_t) * (import_count ? import_count : 1));
+    if (functions != NULL) {
+        image->functions = functions;
+    }
+    *names = tables;
+
+    if (tables == NULL || functions == NULL || module->imports == NULL ||
+        slim_module_read(module->fd, tables, table_size, SLIM_MODULE_HEADER_SIZE) != SL_ERROR_NONE) {
+        return SL_ERROR_LINK;
+    }
+
+    module->base = (u32_t)base;
+    module->code_offset = SLIM_MODULE_HEADER_SIZE + (u32_t)table_size;
+    module->code_size = code_size;
+    module->first_function = image->function_count;
+    module->function_count = function_count;
+    module->import_count = import_count;
+
+    // Functions have to tile the code exactly, that is what keeps execution out of unloaded bodies
+    u32_t expected = 0;
+    for (u32_t i = 0; i < function_count; i++) {
+        const u8_t* entry = tables + (u64_t)i * SLIM_MODULE_FUNCTION_SIZE;
+        SlimFunction* function = &image->functions[image->function_count];
+        u32_t offset = slim_module_u32(entry + SLIM_MODULE_NAME_SIZE);
+        u32_t size = slim_module_u32(entry + SLIM_MODULE_NAME_SIZE + 4);
+        if (offset != expected || size == 0 || size % SLIM_INSTRUCTION_SIZE != 0 || size > code_size - offset) {
+            printf("Invalid function table in %s\n", filename);
+            return SL_ERROR_LINK;
+        }
+
+        memcpy(function->name, entry, SLIM_MODULE_NAME_SIZE);
+        function->name[SLIM_MODULE_NAME_SIZE - 1] = 0;
+        function->module = index;
+        function->address = (u32_t)base + offset;
+        function->size = size;
+        function->loaded = 0;
+        image->function_count++;
+        expected += size;
+    }
+
+    if (expected != code_size) {
+        printf("Invalid function table in %s\n", filename);
+        return SL_ERROR_LINK;
+    }
+
+    return SL_ERROR_NONE;
+}
+
+static SlimError slim_image_symbol(SlimImage* image, const char* name, u32_t* function) {
+    u64_t index;
+    if (!slim_table_get(image->symbols, slim_module_name_hash(name), &index) ||
+        strncmp(image->functions[index].name, name, SLIM_MODULE_NAME_SIZE) != 0) {
+        return SL_ERROR_LINK;
+    }
+
+    *function = (u32_t)index;
+    return SL_ERROR_NONE;
+}
+
+static SlimError slim_image_resolve(SlimImage* image, u32_t index, u8_t* names) {
+    SlimModule* module = &image->modules[index];
+    const u8_t* imports = names + (u64_t)module->function_count * SLIM_MODULE_FUNCTION_SIZE;
+
+    for (u32_t i = 0; i < module->import_count; i++) {
+        char name[SLIM_MODULE_NAME_SIZE];
+        memcpy(name, imports + (u64_t)i * SLIM_MODULE_NAME_SIZE, SLIM_MODULE_NAME_SIZE);
+        name[SLIM_MODULE_NAME_SIZE - 1] = 0;
+
+        if (slim_image_symbol(image, name, &module->imports[i]) != SL_ERROR_NONE) {
+            printf("Unresolved import %s\n", name);
+            return SL_ERROR_LINK;
+        }
+    }
+
+    return SL_ERROR_NONE;
+}
+
+SlimImage* slim_image_link(const char** filenames, u32_t count) {
+    SlimImage* image = calloc(1, sizeof(SlimImage));
+    if (image == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&image->lock, NULL);
+    image->modules = calloc(count ? count : 1, sizeof(SlimModule));
+    u8_t** names = calloc(count ? count : 1, sizeof(u8_t*));
+    u8_t linked = 0;
+    u64_t size = 0;
+
+    if (image->modules == NULL || names == NULL) {
+        goto done;
+    }
+
+    for (u32_t i = 0; i < count; i++) {
+        image->modules[i].fd = -1;
+    }
+    image->module_count = count;
+
+    for (u32_t i = 0; i < count; i++) {
+        if (slim_image_read_module(image, i, filenames[i], size, &names[i]) != SL_ERROR_NONE) {
+            goto done;
+        }
+
+        size += image->modules[i].code_size;
+        if (size >= 0xFFFFFFFFULL) {
+            printf("Image too large\n");
+            goto done;
+        }
+    }
+
+    if (size == 0) {
+        goto done;
+    }
+
+    // Names are hashed into a table of function indices, two names with the same hash are refused like a duplicate
+    image->symbols = slim_table_create(image->function_count);
+    if (image->symbols == NULL) {
+        goto done;
+    }
+
+    for (u32_t i = 0; i < image->function_count; i++) {
+        u8_t inserted;
+        u64_t hash = slim_module_name_hash(image->functions[i].name);
+        if (slim_table_put(image->symbols, hash, i, &inserted) != SL_ERROR_NONE || !inserted) {
+            printf("Duplicate symbol %s\n", image->functions[i].name);
+            goto done;
+        }
+    }
+
+    for (u32_t i = 0; i < count; i++) {
+        if (slim_image_resolve(image, i, names[i]) != SL_ERROR_NONE) {
+            goto done;
+        }
+    }
+
+    // Reserved, not committed: pages only become memory once a function is loaded into them
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) {
+        goto done;
+    }
+    image->data = data;
+    image->size = (u32_t)size;
+
+    image->pending = calloc(size / SLIM_INSTRUCTION_SIZE / 64 + 1, sizeof(u64_t));
+    if (image->pending == NULL) {
+        goto done;
+    }
+
+    for (u32_t i = 0; i < image->function_count; i++) {
+        u32_t index = image->functions[i].address / SLIM_INSTRUCTION_SIZE;
+        image->pending[index / 64] |= 1ULL << (index % 64);
+    }
+    linked = 1;
+
+done:
+    for (u32_t i = 0; names != NULL && i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+
+    if (!linked) {
+        slim_image_destroy(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+void slim_image_destroy(SlimImage* image) {
+    for (u32_t i = 0; image->modules != NULL && i < image->module_count; i++) {
+        if (image->modules[i].fd >= 0) {
+            close(image->modules[i].fd);
+        }
+        free(image->modules[i].imports);
+    }
+
+    if (image->data) {
+        munmap(image->data, image->size);
+    }
+
+    if (image->symbols) {
+        slim_table_destroy(image->symbols);
+    }
+
+    pthread_mutex_destroy(&image->lock);
+    free(image->pending);
+    free(image->modules);
+    free(image->functions);
+    free(image);
+}
+
+SlimError slim_image_lookup(SlimImage* image, const char* name, u32_t* address) {
+    u32_t function;
+    if (slim_image_symbol(image, name, &function) != SL_ERROR_NONE) {
+        return SL_ERROR_LINK;
+    }
+
+    *address = image->functions[function].address;
+    return SL_ERROR_NONE;
+}
+
+// Functions are ordered by address, so the one starting at an address is a binary search away
+static SlimFunction* slim_image_function(SlimImage* image, u32_t address) {
+    u32_t low = 0;
+    u32_t high = image->function_count;
+    while (low < high) {
+        u32_t middle = low + (high - low) / 2;
+        if (image->functions[middle].address < address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < image->function_count && image->functions[low].address == address) {
+        return &image->functions[low];
+    }
+    return NULL;
+}
+
+// Module relative targets stay inside the function or go to the start of another one
+static SlimError slim_image_relocate(SlimImage* image, SlimModule* module, SlimFunction* function, u32_t* target) {
+    u32_t start = function->address - module->base;
+    u8_t inside = *target >= start && *target - start < function->size && (*target - start) % SLIM_INSTRUCTION_SIZE == 0;
+    if (!inside && (*target >= module->code_size || slim_image_function(image, module->base + *target) == NULL)) {
+        return SL_ERROR_LINK;
+    }
+
+    *target += module->base;
+    return SL_ERROR_NONE;
+}
+
+SlimError slim_image_load(SlimImage* image, u32_t address) {
+    SlimFunction* function = slim_image_function(image, address);
+    if (function == NULL) {
+        return SL_ERROR_LINK;
+    }
+
+    pthread_mutex_lock(&image->lock);
+    if (function->loaded) {
+        pthread_mutex_unlock(&image->lock);
+        return SL_ERROR_NONE;
+    }
+
+    SlimModule* module = &image->modules[function->module];
+    u8_t* body = malloc(function->size);
+    SlimError error = body == NULL ? SL_ERROR_LINK : SL_ERROR_NONE;
+    if (error == SL_ERROR_NONE) {
+        error = slim_module_read(
+            module->fd, body, function->size, (u64_t)module->code_offset + function->address - module->base);
+    }
+
+    for (u32_t offset = 0; error == SL_ERROR_NONE && offset < function->size; offset += SLIM_INSTRUCTION_SIZE) {
+        SlimInstruction instruction = slim_instruction_decode(body + offset);
+        switch (instruction.opcode) {
+        case SL_OPCODE_JMP:
+        case SL_OPCODE_JNE:
+        case SL_OPCODE_JE:
+        case SL_OPCODE_SPAWN: error = slim_image_relocate(image, module, function, &instruction.arg1); break;
+        case SL_OPCODE_JMPX:
+            if (instruction.arg1 >= module->import_count) {
+                error = SL_ERROR_LINK;
+                break;
+            }
+            instruction.opcode = SL_OPCODE_JMP;
+            instruction.arg1 = image->functions[module->imports[instruction.arg1]].address;
+            break;
+        case SL_OPCODE_LAZY: error = SL_ERROR_LINK; break;
+        }
+        slim_instruction_encode(body + offset, instruction);
+    }
+
+    if (error == SL_ERROR_NONE) {
+        // Nothing fetches from the function until its bit clears, the release publishes the whole body with it
+        u32_t index = address / SLIM_INSTRUCTION_SIZE;
+        memcpy(image->data + address, body, function->size);
+        __atomic_fetch_and(&image->pending[index / 64], ~(1ULL << (index % 64)), __ATOMIC_RELEASE);
+
+        function->loaded = 1;
+        image->loaded_count++;
+    }
+
+    pthread_mutex_unlock(&image->lock);
+    free(body);
+    return error;
+}
+
+// Pooling -------------------------------------------------------------------------------------------------------------
+SlimMachinePool* slim_machine_pool_create(u32_t capacity) {
+    SlimMachinePool* pool = malloc(sizeof(SlimMachinePool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->machines = malloc(sizeof(SlimMachine*) * (capacity ? capacity : 1));
+    if (pool->machines == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->count = 0;
+    pool->capacity = capacity;
+    return pool;
+}
+
+void slim_machine_pool_destroy(SlimMachinePool* pool) {
+    for (u32_t i = 0; i < pool->count; i++) {
+        slim_machine_destroy(pool->machines[i]);
+    }
+    free(pool->machines);
+    free(pool);
+}
+
+SlimMachine* slim_machine_pool_acquire(SlimMachinePool* pool) {
+    if (pool->count > 0) {
+        return pool->machines[--pool->count];
+    }
+    return slim_machine_create();
+}
+
+void slim_machine_pool_release(SlimMachinePool* pool, SlimMachine* machine) {
+    if (pool->count == pool->capacity) {
+        slim_machine_destroy(machine);
+        return;
+    }
+
+    slim_machine_clear(machine);
+    pool->machines[pool->count++] = machine;
+}
+// Block Management ----------------------------------------------------------------------------------------------------
+SlimBlock* slim_block_create(u32_t start, u32_t end) {
+    SlimBlock* block = malloc(sizeof(SlimBlock));
+    if (block == NULL) {
+        return NULL;
+    }
+    block->allocated = 0;
+    block->start = start;
+    block->end = end;
+    block->next = NULL;
+    return block;
+}
+
+void slim_block_destroy(SlimBlock* block) {
+    if (block->next != NULL) {
+        slim_block_destroy(block->next);
+    }
+    free(block);
+}
+
+// Turns the list back into a single free block spanning [0, end), keeping the head allocation
+void slim_block_reset(SlimBlock* block, u32_t end) {
+    if (block->next != NULL) {
+        slim_block_destroy(block->next);
+    }
+    block->allocated = 0;
+    block->start = 0;
+    block->end = end;
+    block->next = NULL;
 }
 
 SlimError slim_block_split(SlimBlock* block, u32_t size) {
@@ -684,6 +3178,270 @@ SlimError slim_block_merge(SlimBlock* block) {
 
     return SL_ERROR_NONE;
 }
+// Tracing -------------------------------------------------------------------------------------------------------------
+SlimTraceCache* slim_trace_cache_create() {
+    SlimTraceCache* cache = malloc(sizeof(SlimTraceCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    slim_trace_cache_flush(cache);
+    return cache;
+}
+
+void slim_trace_cache_destroy(SlimTraceCache* cache) {
+    free(cache);
+}
+
+void slim_trace_cache_flush(SlimTraceCache* cache) {
+    for (u32_t i = 0; i < SLIM_TRACE_COUNTERS; i++) {
+        cache->counters[i] = 0;
+    }
+
+    for (u32_t i = 0; i < SLIM_TRACE_CACHE_SIZE; i++) {
+        cache->traces[i].length = 0;
+    }
+
+    cache->recording = 0;
+}
+
+SlimTrace* slim_trace_lookup(SlimTraceCache* cache, u32_t address) {
+    SlimTrace* trace = &cache->traces[(address / SLIM_INSTRUCTION_SIZE) % SLIM_TRACE_CACHE_SIZE];
+    if (trace->length == 0 || trace->header != address) {
+        return NULL;
+    }
+    return trace;
+}
+
+// Stack traffic of the instructions a trace may contain, anything else ends the recording
+static u8_t slim_trace_effect(SlimMachine* machine, SlimInstruction instruction, s32_t* pops, s32_t* pushes) {
+    switch (instruction.opcode) {
+    case SL_OPCODE_NOOP: *pops = 0, *pushes = 0; return 1;
+    case SL_OPCODE_LOADI: *pops = 0, *pushes = 1; return 1;
+    case SL_OPCODE_LOADR: *pops = 0, *pushes = 1; return 1;
+    case SL_OPCODE_LOADM: *pops = 1, *pushes = 1; return 1;
+    case SL_OPCODE_DROP: *pops = 1, *pushes = 0; return 1;
+    case SL_OPCODE_STORER: *pops = 1, *pushes = 0; return 1;
+    case SL_OPCODE_STOREM: *pops = 2, *pushes = 0; return 1;
+    case SL_OPCODE_DUP: *pops = 1, *pushes = 2; return 1;
+    case SL_OPCODE_SWAP: *pops = 2, *pushes = 2; return 1;
+    case SL_OPCODE_ROT: *pops = 3, *pushes = 3; return 1;
+    case SL_OPCODE_ADD:
+    case SL_OPCODE_SUB:
+    case SL_OPCODE_MUL:
+    case SL_OPCODE_DIV: *pops = 2, *pushes = 1; return 1;
+    case SL_OPCODE_JMP: *pops = 0, *pushes = 0; return 1;
+    case SL_OPCODE_JNE:
+    case SL_OPCODE_JE: *pops = 1, *pushes = 0; return 1;
+    case SL_OPCODE_NATIVE:
+        if (instruction.arg1 >= SLIM_MACHINE_NATIVES || machine->natives[instruction.arg1].function == NULL) {
+            return 0;
+        }
+        *pops = machine->natives[instruction.arg1].arity, *pushes = 1;
+        return 1;
+    default: return 0;
+    }
+}
+
+// The error flag only stands for a fault raised by the instruction being recorded, launch sets the sticky one aside
+static void slim_trace_record(SlimMachine* machine, u32_t address, SlimInstruction instruction) {
+    SlimTraceCache* cache = machine->traces;
+    SlimTrace* trace = &cache->recorded;
+    s32_t pops;
+    s32_t pushes;
+
+    if (machine->flags.error || machine->flags.halt || trace->length == SLIM_TRACE_LENGTH ||
+        !slim_trace_effect(machine, instruction, &pops, &pushes)) {
+        cache->recording = 0;
+        return;
+    }
+
+    if ((instruction.opcode == SL_OPCODE_LOADR || instruction.opcode == SL_OPCODE_STORER) &&
+        instruction.arg1 >= SLIM_MACHINE_REGISTERS) {
+        cache->recording = 0;
+        return;
+    }
+
+    SlimTraceEntry* entry = &trace->entries[trace->length++];
+    entry->instruction = instruction;
+    entry->value = (u64_t)instruction.arg1 << 32 | instruction.arg2;
+    entry->address = address;
+    entry->taken = machine->instruction_pointer == instruction.arg1;
+    entry->exit = entry->taken ? address + SLIM_INSTRUCTION_SIZE : instruction.arg1;
+
+    if (trace->stack_depth - pops < trace->stack_min) {
+        trace->stack_min = trace->stack_depth - pops;
+    }
+    trace->stack_depth += pushes - pops;
+    if (trace->stack_depth > trace->stack_max) {
+        trace->stack_max = trace->stack_depth;
+    }
+
+    // The loop closed, install the trace over whatever shared its slot
+    if (machine->instruction_pointer == trace->header) {
+        SlimTrace* slot = &cache->traces[(trace->header / SLIM_INSTRUCTION_SIZE) % SLIM_TRACE_CACHE_SIZE];
+        *slot = *trace;
+        cache->recording = 0;
+    }
+}
+
+void slim_trace_observe(SlimMachine* machine, u32_t address, SlimInstruction instruction) {
+    SlimTraceCache* cache = machine->traces;
+    if (cache == NULL) {
+        return;
+    }
+
+    if (cache->recording) {
+        slim_trace_record(machine, address, instruction);
+        return;
+    }
+
+    u8_t jump = instruction.opcode == SL_OPCODE_JMP || instruction.opcode == SL_OPCODE_JNE ||
+                instruction.opcode == SL_OPCODE_JE;
+    u32_t target = instruction.arg1;
+    if (!jump || target > address || machine->instruction_pointer != target) {
+        return;
+    }
+
+    u32_t* counter = &cache->counters[(target / SLIM_INSTRUCTION_SIZE) % SLIM_TRACE_COUNTERS];
+    if (++*counter < SLIM_TRACE_HOT_THRESHOLD || slim_trace_lookup(cache, target) != NULL) {
+        return;
+    }
+
+    *counter = 0;
+    cache->recording = 1;
+    cache->recorded.header = target;
+    cache->recorded.length = 0;
+    cache->recorded.stack_min = 0;
+    cache->recorded.stack_max = 0;
+    cache->recorded.stack_depth = 0;
+}
+
+// Runs the trace until a guard fails, returns the number of instructions retired. Stack bounds are checked once per
+// iteration against the recorded extremes, so the body works on the stack array directly.
+u32_t slim_trace_run(SlimMachine* machine, SlimTrace* trace) {
+    u64_t* stack = machine->stack;
+    u64_t* registers = machine->registers;
+    u64_t* memory = machine->memory;
+    u32_t stack_pointer = machine->stack_pointer;
+    u32_t stack_high = stack_pointer;
+    u32_t exit = trace->header;
+    u32_t retired = 0;
+    u64_t value;
+
+    for (;;) {
+        if ((s32_t)stack_pointer + trace->stack_min < 0 ||
+            (s32_t)stack_pointer + trace->stack_max > SLIM_MACHINE_STACK_SIZE) {
+            goto done;
+        }
+
+        if (stack_pointer + trace->stack_max > stack_high) {
+            stack_high = stack_pointer + trace->stack_max;
+        }
+
+        for (u32_t i = 0; i < trace->length; i++) {
+            SlimTraceEntry* entry = &trace->entries[i];
+            u32_t arg1 = entry->instruction.arg1;
+
+            switch (entry->instruction.opcode) {
+            case SL_OPCODE_NOOP: break;
+            case SL_OPCODE_LOADI: stack[stack_pointer++] = entry->value; break;
+            case SL_OPCODE_LOADR: stack[stack_pointer++] = registers[arg1]; break;
+            case SL_OPCODE_LOADM:
+                stack[stack_pointer - 1] = memory[(u32_t)stack[stack_pointer - 1] + arg1];
+                break;
+            case SL_OPCODE_DROP: stack_pointer--; break;
+            case SL_OPCODE_STORER: registers[arg1] = stack[--stack_pointer]; break;
+            case SL_OPCODE_STOREM:
+                value = stack[--stack_pointer];
+                memory[(u32_t)value + arg1] = stack[--stack_pointer];
+                slim_machine_mark_dirty(machine, (u32_t)value + arg1, 1);
+                break;
+            case SL_OPCODE_DUP:
+                stack[stack_pointer] = stack[stack_pointer - 1];
+                stack_pointer++;
+                break;
+            case SL_OPCODE_SWAP:
+                value = stack[stack_pointer - 1];
+                stack[stack_pointer - 1] = stack[stack_pointer - 2];
+                stack[stack_pointer - 2] = value;
+                break;
+            case SL_OPCODE_ROT:
+                value = stack[stack_pointer - 3];
+                stack[stack_pointer - 3] = stack[stack_pointer - 2];
+                stack[stack_pointer - 2] = stack[stack_pointer - 1];
+                stack[stack_pointer - 1] = value;
+                break;
+            case SL_OPCODE_ADD:
+                stack[stack_pointer - 2] = stack[stack_pointer - 1] + stack[stack_pointer - 2];
+                stack_pointer--;
+                break;
+            case SL_OPCODE_SUB:
+                stack[stack_pointer - 2] = stack[stack_pointer - 1] - stack[stack_pointer - 2];
+                stack_pointer--;
+                break;
+            case SL_OPCODE_MUL:
+                stack[stack_pointer - 2] = stack[stack_pointer - 1] * stack[stack_pointer - 2];
+                stack_pointer--;
+                break;
+            case SL_OPCODE_DIV:
+                // Leave the fault to the interpreter
+                if (stack[stack_pointer - 2] == 0) {
+                    exit = entry->address;
+                    goto done;
+                }
+                stack[stack_pointer - 2] = stack[stack_pointer - 1] / stack[stack_pointer - 2];
+                stack_pointer--;
+                break;
+            case SL_OPCODE_JMP: break;
+            case SL_OPCODE_NATIVE: {
+                SlimNativeEntry* native = &machine->natives[arg1];
+                u64_t* args = stack + stack_pointer - native->arity;
+
+                // Natives may look at the machine, so it has to be in sync for the call
+                machine->stack_pointer = stack_pointer;
+                SlimError error = native->function(machine, args, native->arity, &value);
+                if (error != SL_ERROR_NONE) {
+                    machine->flags.error = 1;
+                    if (error < SL_ERROR_COUNT) {
+                        machine->stats.faults[error]++;
+                    }
+                    retired++;
+                    exit = entry->address + SLIM_INSTRUCTION_SIZE;
+                    goto done;
+                }
+                stack_pointer -= native->arity;
+                stack[stack_pointer++] = value;
+                break;
+            }
+            case SL_OPCODE_JNE:
+            case SL_OPCODE_JE:
+                value = stack[--stack_pointer];
+                if (((entry->instruction.opcode == SL_OPCODE_JNE) == (value != 0)) != entry->taken) {
+                    retired++;
+                    exit = entry->exit;
+                    goto done;
+                }
+                break;
+            }
+
+            retired++;
+        }
+    }
+
+done:
+    // Popped slots read as zero everywhere else in the machine
+    for (u32_t i = stack_pointer; i < stack_high; i++) {
+        stack[i] = 0;
+    }
+
+    machine->stack_pointer = stack_pointer;
+    machine->instruction_pointer = exit;
+    machine->stats.instructions += retired;
+    if (stack_high > machine->stats.stack_high) {
+        machine->stats.stack_high = stack_high;
+    }
+    return retired;
+}
 // Debugging -----------------------------------------------------------------------------------------------------------
 void slim_machine_dump_stack(SlimMachine* machine) {
     printf("Stack:\n");
@@ -712,4 +3470,64 @@ void slim_machine_dump_memory(SlimMachine* machine) {
     }
 
     printf("\n");
-}
\ No newline at end of file
+}
+// Telemetry -----------------------------------------------------------------------------------------------------------
+void slim_machine_stats(SlimMachine* machine, SlimStats* stats) {
+    // The machine itself on top of the children it joined
+    *stats = machine->stats;
+    stats->machines++;
+
+    for (SlimBlock* block = machine->blocks; block != NULL; block = block->next) {
+        u64_t bytes = (u64_t)(block->end - block->start) * sizeof(u64_t);
+        if (block->allocated) {
+            stats->bytes_live += bytes;
+        } else {
+            stats->bytes_free += bytes;
+            if (bytes > stats->largest_free) {
+                stats->largest_free = bytes;
+            }
+        }
+    }
+
+    if (stats->bytes_free > 0) {
+        stats->fragmentation = 1.0 - (f64_t)stats->largest_free / (f64_t)stats->bytes_free;
+    }
+}
+
+void slim_stats_merge(SlimStats* into, const SlimStats* from) {
+    into->machines += from->machines;
+    into->instructions += from->instructions;
+    into->allocs += from->allocs;
+    into->frees += from->frees;
+    into->bytes_live += from->bytes_live;
+    into->bytes_free += from->bytes_free;
+
+    if (from->largest_free > into->largest_free) {
+        into->largest_free = from->largest_free;
+    }
+
+    if (from->fragmentation > into->fragmentation) {
+        into->fragmentation = from->fragmentation;
+    }
+
+    if (from->stack_high > into->stack_high) {
+        into->stack_high = from->stack_high;
+    }
+
+    for (u32_t i = 0; i < SL_ERROR_COUNT; i++) {
+        into->faults[i] += from->faults[i];
+    }
+}
+
+// One JSON object per call, faults are indexed by SlimError code
+void slim_stats_export(const SlimStats* stats, FILE* out) {
+    fprintf(out, "{\"machines\": %llu, \"instructions\": %llu, \"allocs\": %llu, \"frees\": %llu, ", stats->machines,
+        stats->instructions, stats->allocs, stats->frees);
+    fprintf(out, "\"bytes_live\": %llu, \"bytes_free\": %llu, \"largest_free\": %llu, \"fragmentation\": %.4f, ",
+        stats->bytes_live, stats->bytes_free, stats->largest_free, stats->fragmentation);
+    fprintf(out, "\"stack_high\": %u, \"faults\": [", stats->stack_high);
+    for (u32_t i = 0; i < SL_ERROR_COUNT; i++) {
+        fprintf(out, i ? ", %llu" : "%llu", stats->faults[i]);
+    }
+    fprintf(out, "]}\n");
+}
@@ -1,11 +1,40 @@
 #pragma once
 // ---------------------------------------------------------------------------------------------------------------------
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 // ================================================DEFINITION===========================================================
+// Bumped whenever the module format or the meaning of an opcode changes, older modules then fail to link
+#define SLIM_VERSION 1
+
 #define SLIM_MACHINE_STACK_SIZE 8
 #define SLIM_MACHINE_REGISTERS 4
 #define SLIM_MACHINE_MEMORY_SIZE 16
+#define SLIM_MACHINE_NATIVES 16
+#define SLIM_MACHINE_CHANNELS 8
+#define SLIM_MACHINE_CHILDREN 8
+#define SLIM_MACHINE_STREAMS 8
+#define SLIM_MACHINE_TABLES 16
+
+#define SLIM_SCHEDULER_QUEUE_SIZE 256
+
+#define SLIM_SEGMENT_CLASSES 16
+#define SLIM_SEGMENT_CACHE_SIZE 16
+#define SLIM_SEGMENT_NULL 0xFFFFFFFF
+#define SLIM_SEGMENT_FREED 0x80
+
+#define SLIM_STREAM_BUFFER_SIZE (1 << 20)
+
+#define SLIM_TABLE_GROUP 16
+
+#define SLIM_MODULE_MAGIC 0x534C4D44
+#define SLIM_MODULE_NAME_SIZE 32
+
+#define SLIM_TRACE_HOT_THRESHOLD 16
+#define SLIM_TRACE_LENGTH 64
+#define SLIM_TRACE_CACHE_SIZE 16
+#define SLIM_TRACE_COUNTERS 64
 // ---------------------------------------------------------------------------------------------------------------------
 typedef unsigned char u8_t;
 typedef unsigned short u16_t;
@@ -30,6 +59,20 @@ enum SlimError {
     SL_ERROR_BLOCK_MERGE = 0x5,
     SL_ERROR_BLOCK_ALLOC = 0x6,
     SL_ERROR_BLOCK_FREE = 0x7,
+    SL_ERROR_OBJECT_LOAD = 0x8,
+    SL_ERROR_INVALID_NATIVE = 0x9,
+    SL_ERROR_INVALID_ADDRESS = 0xA,
+    SL_ERROR_INVALID_CHANNEL = 0xB,
+    SL_ERROR_CHANNEL_FULL = 0xC,
+    SL_ERROR_CHANNEL_EMPTY = 0xD,
+    SL_ERROR_SPAWN = 0xE,
+    SL_ERROR_SEGMENT = 0xF,
+    SL_ERROR_STREAM = 0x10,
+    SL_ERROR_TABLE = 0x11,
+    SL_ERROR_LINK = 0x12,
+
+    // Not an error, the number of codes above
+    SL_ERROR_COUNT,
 };
 
 #define slim_todo()                                                                                                    \
@@ -44,20 +87,55 @@ enum SlimError {
         return error                                                                                                   \
     }
 
+// Per-instruction tracing on stdout. Building with -DSLIM_QUIET compiles it out, which is how the benchmarks compare
+// the interpreter, traces and compiled code: the trace and compiled paths never print, so timing the interpreter with
+// its printf in place mostly measures stdio.
+#ifdef SLIM_QUIET
+#define slim_print(...)                                                                                                \
+    do {                                                                                                               \
+        if (0) {                                                                                                       \
+            printf(__VA_ARGS__);                                                                                       \
+        }                                                                                                              \
+    } while (0)
+#else
+#define slim_print(...) printf(__VA_ARGS__)
+#endif
+
 #define slim_machine_except(machine, error)                                                                            \
     {                                                                                                                  \
         if (error != SL_ERROR_NONE) {                                                                                  \
             machine->flags.error = 1;                                                                                  \
+            if (error < SL_ERROR_COUNT) {                                                                              \
+                machine->stats.faults[error]++;                                                                        \
+            }                                                                                                          \
             return;                                                                                                    \
         }                                                                                                              \
     }
 // ---------------------------------------------------------------------------------------------------------------------
 typedef struct SlimMachine SlimMachine;
 typedef struct SlimMachineFlags SlimMachineFlags;
+typedef struct SlimStats SlimStats;
 typedef struct SlimInstruction SlimInstruction;
 typedef struct SlimBytecode SlimBytecode;
 typedef enum SlimOpcode SlimOpcode;
 typedef struct SlimBlock SlimBlock;
+typedef struct SlimMachinePool SlimMachinePool;
+typedef struct SlimChannel SlimChannel;
+typedef enum SlimChannelMode SlimChannelMode;
+typedef struct SlimTask SlimTask;
+typedef struct SlimTaskQueue SlimTaskQueue;
+typedef struct SlimScheduler SlimScheduler;
+typedef struct SlimSegment SlimSegment;
+typedef struct SlimSegmentCache SlimSegmentCache;
+typedef struct SlimStream SlimStream;
+typedef struct SlimTable SlimTable;
+typedef struct SlimImage SlimImage;
+typedef struct SlimModule SlimModule;
+typedef struct SlimFunction SlimFunction;
+typedef struct SlimNativeEntry SlimNativeEntry;
+typedef struct SlimTraceEntry SlimTraceEntry;
+typedef struct SlimTrace SlimTrace;
+typedef struct SlimTraceCache SlimTraceCache;
 // Logic and Control Flow - Instructions, Routines, and Opcodes --------------------------------------------------------
 enum SlimOpcode {
     // clang-format off
@@ -93,13 +171,48 @@ enum SlimOpcode {
     SL_OPCODE_JMP       = 0x50,     // Jump to specified address                                JMP ADDR
     SL_OPCODE_JNE       = 0x51,     // Jump to specified address if stack top not equal to zero JNE ADDR
     SL_OPCODE_JE        = 0x52,     // Jump to specified address if stack top equal to zero     JE ADDR
+
+    SL_OPCODE_NATIVE    = 0x60,     // Call a host function on the top ARITY stack values       NATIVE IDX
+    SL_OPCODE_NATIVEM   = 0x61,     // Call a host function on memory, length [1] at addr [0]   NATIVEM IDX
+
+    SL_OPCODE_SEND      = 0x70,     // Send the top of the stack, waits while the channel is full   SEND CH
+    SL_OPCODE_RECV      = 0x71,     // Receive onto the stack, waits while the channel is empty     RECV CH
+    SL_OPCODE_TRYRECV   = 0x72,     // Receive without waiting, pushes the value and 1, or 0 0      TRYRECV CH
+    SL_OPCODE_SENDM     = 0x73,     // Send memory, length [1] at addr [0], as one batch            SENDM CH
+    SL_OPCODE_RECVM     = 0x74,     // Receive a batch into memory, length [1] at addr [0]          RECVM CH
+
+    SL_OPCODE_SPAWN     = 0x80,     // Start a child at ADDR with the top of the stack as argument  SPAWN ADDR
+    SL_OPCODE_JOIN      = 0x81,     // Wait for all children, push their results in spawn order     JOIN
+
+    SL_OPCODE_LOADM_ACQ = 0x90,     // Acquire load from the shared segment at addr [0]             LOADM_ACQ FIELD_OFFSET
+    SL_OPCODE_STOREM_REL= 0x91,     // Release store of [1] to the shared segment at addr [0]       STOREM_REL FIELD_OFFSET
+    SL_OPCODE_CAS       = 0x92,     // Replace [2] with [1] at addr [0], push the old value and 1/0 CAS FIELD_OFFSET
+    SL_OPCODE_FETCH_ADD = 0x93,     // Add [1] to the word at addr [0], push the old value          FETCH_ADD FIELD_OFFSET
+    SL_OPCODE_XCHG      = 0x94,     // Swap [1] with the word at addr [0], push the old value       XCHG FIELD_OFFSET
+    SL_OPCODE_SALLOC    = 0x95,     // Allocate in the shared segment, push the address             SALLOC SIZE
+    SL_OPCODE_SFREE     = 0x96,     // Free the shared segment block at addr [0]                    SFREE
+
+    SL_OPCODE_READ      = 0xA0,     // Read up to 8 bytes as a word, push it and the byte count     READ S
+    SL_OPCODE_READLINE  = 0xA1,     // Push the next line's window offset, length and 1, or 0 0 0   READLINE S
+    SL_OPCODE_PEEK      = 0xA2,     // Push the byte at window offset [0]                           PEEK S
+    SL_OPCODE_WRITE     = 0xA3,     // Write the low N bytes of [0]                                 WRITE S N
+    SL_OPCODE_WRITEW    = 0xA4,     // Copy window of S2, length [1] at offset [0], to S            WRITEW S S2
+
+    SL_OPCODE_HNEW      = 0xB0,     // Create a hash table, push its handle                         HNEW CAPACITY
+    SL_OPCODE_HGET      = 0xB1,     // Look up key [0] in table [1], push the value and 1, or 0 0   HGET
+    SL_OPCODE_HPUT      = 0xB2,     // Set key [0] to [1] in table [2], push 1 if the key is new    HPUT
+    SL_OPCODE_HDEL      = 0xB3,     // Remove key [0] from table [1], push 1 if it was there        HDEL
+    SL_OPCODE_HLEN      = 0xB4,     // Push the number of keys in table [0]                         HLEN
+
+    SL_OPCODE_JMPX      = 0xC0,     // Jump to an imported function, only valid inside a module     JMPX IMPORT
+    SL_OPCODE_LAZY      = 0xC1,     // Load a function on first entry, issued by fetch              LAZY ADDRESS
     // clang-format on
 };
 
 struct SlimBytecode {
     u8_t* data;
-    u8_t size;
-    u16_t bytesize;
+    u32_t size;
+    u32_t bytesize;
 };
 
 struct SlimInstruction {
@@ -110,8 +223,21 @@ struct SlimInstruction {
 
 typedef void (*SlimRoutine)(SlimMachine* machine, SlimInstruction instruction);
 
+// Entry point of an ahead-of-time compiled program, see tools/slim_aot.c
+typedef void (*SlimEntry)(SlimMachine* machine);
+#define SLIM_AOT_ENTRY "slim_aot_entry"
+// Hash and size of the bytecode the object was compiled from, checked when it is bound
+#define SLIM_AOT_HASH "slim_aot_hash"
+#define SLIM_AOT_SIZE "slim_aot_size"
+
 SlimBytecode* slim_bytecode_load(const char* filename);
 void slim_bytecode_destroy(SlimBytecode* bytecode);
+u64_t slim_bytecode_hash(const u8_t* data, u32_t size);
+
+// Every instruction is 9 bytes: the opcode followed by two big-endian 32-bit arguments
+#define SLIM_INSTRUCTION_SIZE 9
+SlimInstruction slim_instruction_decode(const u8_t* data);
+void slim_instruction_encode(u8_t* data, SlimInstruction instruction);
 
 void slim_routine_nop(SlimMachine* machine, SlimInstruction instruction);
 void slim_routine_halt(SlimMachine* machine, SlimInstruction instruction);
@@ -145,6 +271,51 @@ void slim_routine_jmp(SlimMachine* machine, SlimInstruction instruction);
 void slim_routine_jne(SlimMachine* machine, SlimInstruction instruction);
 void slim_routine_je(SlimMachine* machine, SlimInstruction instruction);
 
+void slim_routine_native(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_nativem(SlimMachine* machine, SlimInstruction instruction);
+
+void slim_routine_send(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_recv(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_tryrecv(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_sendm(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_recvm(SlimMachine* machine, SlimInstruction instruction);
+
+void slim_routine_spawn(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_join(SlimMachine* machine, SlimInstruction instruction);
+
+void slim_routine_loadm_acq(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_storem_rel(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_cas(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_fetch_add(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_xchg(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_salloc(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_sfree(SlimMachine* machine, SlimInstruction instruction);
+
+void slim_routine_read(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_readline(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_peek(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_write(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_writew(SlimMachine* machine, SlimInstruction instruction);
+
+void slim_routine_hnew(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_hget(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_hput(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_hdel(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_hlen(SlimMachine* machine, SlimInstruction instruction);
+
+void slim_routine_jmpx(SlimMachine* machine, SlimInstruction instruction);
+void slim_routine_lazy(SlimMachine* machine, SlimInstruction instruction);
+
+// Host Functions - Natives --------------------------------------------------------------------------------------------
+// A native receives its arguments in place, either the top stack slots (deepest first) or a memory range, and leaves
+// a single result which replaces them. It must not push or pop on the machine itself.
+typedef SlimError (*SlimNative)(SlimMachine* machine, u64_t* args, u32_t count, u64_t* result);
+
+struct SlimNativeEntry {
+    SlimNative function;
+    u32_t arity;
+};
+
 // State and Data - Machine, Errors, and Memory ------------------------------------------------------------------------
 struct SlimMachineFlags {
     u16_t zero : 1;
@@ -155,6 +326,27 @@ struct SlimMachineFlags {
     u16_t decimal : 1;
     u16_t error : 1;
     u16_t halt : 1;
+    u16_t wait : 1;
+};
+
+// Counters are bumped as the machine runs, the heap figures are only filled in by slim_machine_stats. Memory sizes
+// are in bytes even though the machine allocates in words. A machine counts the children it joined, and itself.
+// Clearing zeroes them, so a pooled machine reports each run on its own.
+struct SlimStats {
+    u64_t machines;
+    u64_t instructions;
+    u64_t allocs;
+    u64_t frees;
+
+    u64_t bytes_live;
+    u64_t bytes_free;
+    u64_t largest_free;
+
+    // 1 - largest free block / free bytes, 0 when all free memory is one block
+    f64_t fragmentation;
+
+    u32_t stack_high;
+    u64_t faults[SL_ERROR_COUNT];
 };
 
 struct SlimMachine {
@@ -175,8 +367,48 @@ struct SlimMachine {
     SlimBlock* blocks;
     u64_t memory[SLIM_MACHINE_MEMORY_SIZE];
 
+    // One past the highest memory word written since the last clear, everything above it is still zero
+    u32_t memory_high;
+
+    SlimNativeEntry natives[SLIM_MACHINE_NATIVES];
+    SlimChannel* channels[SLIM_MACHINE_CHANNELS];
+
+    // The channel and batch the machine last had to wait for, slim_machine_park sleeps on it
+    SlimChannel* blocked;
+    u32_t blocked_count;
+    u8_t blocked_send;
+
+    // Children started by SPAWN and not yet collected by JOIN
+    SlimScheduler* scheduler;
+    SlimTask* children[SLIM_MACHINE_CHILDREN];
+    u32_t child_count;
+
+    // A machine runs on one thread at a time, so its allocation cache doubles as a per-thread cache
+    SlimSegment* segment;
+    SlimSegmentCache* segment_cache;
+
+    // Not inherited by children, a stream's cursor and buffer belong to one thread
+    SlimStream* streams[SLIM_MACHINE_STREAMS];
+
+    // Created by HNEW and freed on clear, handles are indices into this array
+    SlimTable* tables[SLIM_MACHINE_TABLES];
+
+    SlimTraceCache* traces;
+    SlimStats stats;
+
+    // Set when the bytecode is a linked image, it still loads functions as they are reached
+    SlimImage* image;
+
     u8_t* bytecode;
     u32_t bytecode_size;
+
+    // Computed on first use, loading a different buffer clears it
+    u64_t bytecode_hash;
+    u8_t bytecode_hashed;
+
+    // When bound, the compiled object runs instead of the interpreter
+    SlimEntry entry;
+    void* object;
 };
 
 // Fetch, Decode, Execute
@@ -188,7 +420,17 @@ void slim_machine_execute(SlimMachine* machine, SlimRoutine routine, SlimInstruc
 SlimMachine* slim_machine_create();
 void slim_machine_destroy(SlimMachine* machine);
 void slim_machine_clear(SlimMachine* machine);
+void slim_machine_mark_dirty(SlimMachine* machine, u32_t address, u32_t length);
 void slim_machine_load(SlimMachine* machine, u8_t* data, u32_t size);
+// Binds a slim-aot object to the loaded bytecode, which must be the program it was compiled from
+SlimError slim_machine_load_object(SlimMachine* machine, const char* filename);
+SlimError slim_machine_register_native(SlimMachine* machine, u32_t index, SlimNative function, u32_t arity);
+SlimError slim_machine_attach_channel(SlimMachine* machine, u32_t index, SlimChannel* channel);
+void slim_machine_park(SlimMachine* machine);
+void slim_machine_attach_scheduler(SlimMachine* machine, SlimScheduler* scheduler);
+void slim_machine_map_segment(SlimMachine* machine, SlimSegment* segment);
+SlimError slim_machine_attach_stream(SlimMachine* machine, u32_t index, SlimStream* stream);
+void slim_machine_load_image(SlimMachine* machine, SlimImage* image);
 void slim_machine_launch(SlimMachine* machine);
 
 // Internal API - Called by routines to manipulate the machine
@@ -200,6 +442,236 @@ SlimError ___slim_machine_read(SlimMachine* machine, u32_t address, u32_t offset
 SlimError ___slim_machine_write(SlimMachine* machine, u32_t address, u32_t offset);
 SlimError ___slim_machine_alloc(SlimMachine* machine, u32_t size, u32_t* address);
 SlimError ___slim_machine_free(SlimMachine* machine, u32_t address);
+SlimError ___slim_machine_native(SlimMachine* machine, u32_t index);
+SlimError ___slim_machine_native_memory(SlimMachine* machine, u32_t index, u32_t address, u32_t length);
+SlimError ___slim_machine_send(SlimMachine* machine, u32_t index, u64_t* values, u32_t count);
+SlimError ___slim_machine_receive(SlimMachine* machine, u32_t index, u64_t* values, u32_t count);
+SlimError ___slim_machine_spawn(SlimMachine* machine, u32_t address, u64_t argument);
+SlimError ___slim_machine_join(SlimMachine* machine);
+SlimError ___slim_machine_shared(SlimMachine* machine, u64_t address, u32_t offset, _Atomic u64_t** word);
+SlimError ___slim_machine_stream(SlimMachine* machine, u32_t index, SlimStream** stream);
+SlimError ___slim_machine_table(SlimMachine* machine, u64_t handle, SlimTable** table);
+
+// Channels - Lock-Free Rings Between Machines ------------------------------------------------------------------------
+// Bounded rings of u64_t the host wires between machines. Batches are all or nothing. A machine that would block on
+// a full or empty channel sets flags.wait and returns from slim_machine_launch with the instruction pointer still on
+// the channel instruction, the host scheduler launches it again once the peer made progress. slim_machine_park sleeps
+// until then, a successful send or receive only takes the channel lock when somebody is asleep on it.
+enum SlimChannelMode {
+    SL_CHANNEL_SPSC = 0x0, // One producer, one consumer
+    SL_CHANNEL_MPSC = 0x1, // Any number of producers, one consumer
+};
+
+struct SlimChannel {
+    SlimChannelMode mode;
+    u32_t capacity;
+    u64_t* values;
+
+    // Multi-producer channels publish each slot through its sequence number
+    _Atomic u64_t* sequences;
+
+    // Kept on separate cache lines, they are written from different cores
+    _Alignas(64) _Atomic u64_t head;
+    _Alignas(64) _Atomic u64_t tail;
+
+    // Parked machines wait here for the other side to make progress
+    _Alignas(64) _Atomic u32_t sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+};
+
+SlimChannel* slim_channel_create(u32_t capacity, SlimChannelMode mode);
+void slim_channel_destroy(SlimChannel* channel);
+u32_t slim_channel_send(SlimChannel* channel, const u64_t* values, u32_t count);
+u32_t slim_channel_receive(SlimChannel* channel, u64_t* values, u32_t count);
+void slim_channel_park(SlimChannel* channel, u32_t count, u8_t send);
+
+// Scheduling - Fork-Join on a Work-Stealing Pool ---------------------------------------------------------------------
+// A child shares the parent's bytecode, natives and channels, starts with its own stack and registers and a read-only
+// snapshot of the parent's memory. Spawns from a worker go to the bottom of its own queue, idle workers steal from the
+// top of the others. A joining thread runs queued tasks while it waits, so nested fork-join can't starve the pool, and
+// sleeps once there are none. A task blocked on a channel also runs queued work before it parks, the peer it waits for
+// may be sitting in a queue. Machines without a scheduler start a thread per child at SPAWN and join it at JOIN.
+struct SlimTask {
+    SlimMachine* machine;
+    _Atomic u8_t done;
+
+    // Only used without a scheduler
+    pthread_t thread;
+};
+
+struct SlimTaskQueue {
+    SlimScheduler* scheduler;
+    pthread_mutex_t lock;
+    SlimTask* tasks[SLIM_SCHEDULER_QUEUE_SIZE];
+    u32_t head;
+    u32_t tail;
+};
+
+struct SlimScheduler {
+    pthread_t* threads;
+    SlimTaskQueue* queues;
+    u32_t workers;
+
+    _Atomic u32_t queued;
+    _Atomic u32_t next;
+    _Atomic u8_t stopping;
+
+    // Idle workers and joiners sleep here until something is queued or a task is done
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+};
+
+SlimScheduler* slim_scheduler_create(u32_t workers);
+void slim_scheduler_destroy(SlimScheduler* scheduler);
+void slim_scheduler_submit(SlimScheduler* scheduler, SlimTask* task);
+void slim_scheduler_wait(SlimScheduler* scheduler, SlimTask* task);
+void slim_task_run(SlimTask* task);
+
+// Shared Memory - Segments Mapped by Several Machines ----------------------------------------------------------------
+// A segment is an array of atomic u64_t words addressed by index. Allocation hands out power of two blocks from
+// per-class free lists behind a lock, refilled and drained in batches through each machine's local cache.
+struct SlimSegment {
+    _Atomic u64_t* words;
+    u32_t size;
+
+    // Size class of the block starting at each word, with SLIM_SEGMENT_FREED set while it is free
+    u8_t* classes;
+
+    pthread_mutex_t lock;
+    u32_t bump;
+    u32_t free[SLIM_SEGMENT_CLASSES];
+};
+
+struct SlimSegmentCache {
+    u32_t count[SLIM_SEGMENT_CLASSES];
+    u32_t blocks[SLIM_SEGMENT_CLASSES][SLIM_SEGMENT_CACHE_SIZE];
+};
+
+SlimSegment* slim_segment_create(u32_t size);
+void slim_segment_destroy(SlimSegment* segment);
+SlimError slim_segment_alloc(SlimSegment* segment, SlimSegmentCache* cache, u32_t size, u32_t* address);
+// Freeing a block twice, or an address that is not the start of a block, is SL_ERROR_INVALID_ADDRESS
+SlimError slim_segment_free(SlimSegment* segment, SlimSegmentCache* cache, u32_t address);
+void slim_segment_flush(SlimSegment* segment, SlimSegmentCache* cache);
+
+// Streams - Mapped Input and Batched Output ---------------------------------------------------------------------------
+// Input files are mapped read-only and consumed through a cursor, READLINE hands out offsets into the mapping instead
+// of copying lines, and PEEK/WRITEW work on those offsets directly. Output collects in a large buffer that goes out in
+// a single write(2) when it fills, on slim_stream_flush and on destroy.
+struct SlimStream {
+    const u8_t* window;
+    u64_t size;
+    u64_t position;
+
+    int fd;
+    u8_t* buffer;
+    u32_t length;
+    u32_t capacity;
+};
+
+SlimStream* slim_stream_open(const char* filename);
+SlimStream* slim_stream_create(int fd, u32_t capacity);
+void slim_stream_destroy(SlimStream* stream);
+SlimError slim_stream_write(SlimStream* stream, const u8_t* data, u64_t length);
+SlimError slim_stream_flush(SlimStream* stream);
+
+// Hash Tables - Open Addressing with Group Probing --------------------------------------------------------------------
+// Swiss-table layout: one control byte per slot holding 7 bits of the hash, or EMPTY/DELETED, scanned a group of 16 at
+// a time (SSE2 where available), so most lookups touch one control group and one key. Tables are too large for machine
+// memory and live on the host side, the program only sees a handle.
+struct SlimTable {
+    u8_t* control;
+    u64_t* keys;
+    u64_t* values;
+
+    // Always a power of two and a whole number of groups
+    u32_t capacity;
+    u32_t count;
+    u32_t deleted;
+};
+
+SlimTable* slim_table_create(u32_t capacity);
+void slim_table_destroy(SlimTable* table);
+u8_t slim_table_get(SlimTable* table, u64_t key, u64_t* value);
+SlimError slim_table_put(SlimTable* table, u64_t key, u64_t value, u8_t* inserted);
+u8_t slim_table_delete(SlimTable* table, u64_t key);
+
+// Modules - Linking with Lazily Loaded Functions ----------------------------------------------------------------------
+// A .slm module is a header, a function table, an import table and the code, with big-endian u32_t fields:
+//
+//     magic version function_count import_count code_size
+//     function_count x { name[SLIM_MODULE_NAME_SIZE] offset size }
+//     import_count x { name[SLIM_MODULE_NAME_SIZE] }
+//     code
+//
+// Functions cover the code back to back. Jump targets are relative to the module and JMPX jumps to an import by index.
+// Linking reads only the tables: it reserves the whole image without touching it, resolves every import by name and
+// marks the start of each function as pending. Fetch runs LAZY in place of a pending start, which reads the function
+// body from its module, relocates it with JMPX turned into JMP and copies it into the image. A function may only jump
+// inside itself or to the start of a function, so nothing can land in a body that isn't loaded yet. A function that
+// fails to load raises SL_ERROR_LINK and halts the machine. The image lock serialises first calls.
+struct SlimModule {
+    int fd;
+    u32_t base;
+    u32_t code_offset;
+    u32_t code_size;
+
+    u32_t first_function;
+    u32_t function_count;
+
+    // Function index of each import
+    u32_t* imports;
+    u32_t import_count;
+};
+
+struct SlimFunction {
+    char name[SLIM_MODULE_NAME_SIZE];
+    u32_t module;
+    u32_t address;
+    u32_t size;
+    u8_t loaded;
+};
+
+struct SlimImage {
+    u8_t* data;
+    u32_t size;
+
+    SlimModule* modules;
+    u32_t module_count;
+
+    // Ordered by address, modules are laid out in link order
+    SlimFunction* functions;
+    u32_t function_count;
+    u32_t loaded_count;
+
+    // Function index by name hash
+    SlimTable* symbols;
+
+    // One bit per instruction, set at the start of each function not loaded yet
+    u64_t* pending;
+
+    pthread_mutex_t lock;
+};
+
+SlimImage* slim_image_link(const char** filenames, u32_t count);
+void slim_image_destroy(SlimImage* image);
+SlimError slim_image_load(SlimImage* image, u32_t address);
+SlimError slim_image_lookup(SlimImage* image, const char* name, u32_t* address);
+
+// Pooling - Recycled Machines ----------------------------------------------------------------------------------------
+// Released machines are cleared and handed out again by acquire. Only the execution state is reset, the loaded
+// bytecode, natives and compiled object stay bound, so a pool is meant to serve a single program. Not thread safe.
+struct SlimMachinePool {
+    SlimMachine** machines;
+    u32_t count;
+    u32_t capacity;
+};
+
+SlimMachinePool* slim_machine_pool_create(u32_t capacity);
+void slim_machine_pool_destroy(SlimMachinePool* pool);
+SlimMachine* slim_machine_pool_acquire(SlimMachinePool* pool);
+void slim_machine_pool_release(SlimMachinePool* pool, SlimMachine* machine);
 
 // Block and Memory Management -----------------------------------------------------------------------------------------
 struct SlimBlock {
@@ -211,10 +683,54 @@ struct SlimBlock {
 
 SlimBlock* slim_block_create(u32_t start, u32_t end);
 void slim_block_destroy(SlimBlock* block);
+void slim_block_reset(SlimBlock* block, u32_t end);
 SlimError slim_block_split(SlimBlock* block, u32_t size);
 SlimError slim_block_merge(SlimBlock* block);
 
+// Tracing - Hot Loops and the Trace Cache ----------------------------------------------------------------------------
+// Backward jump targets are counted, once a loop header gets hot the next iteration is recorded as a linear trace.
+// Branches inside the trace become guards, a failing guard exits to the interpreter at the path not recorded.
+struct SlimTraceEntry {
+    SlimInstruction instruction;
+    u64_t value;
+    u32_t address;
+    u32_t exit;
+    u8_t taken;
+};
+
+struct SlimTrace {
+    u32_t header;
+    u32_t length;
+
+    // Lowest and highest stack depth reached in one iteration, relative to the depth at the header
+    s32_t stack_min;
+    s32_t stack_max;
+    s32_t stack_depth;
+
+    SlimTraceEntry entries[SLIM_TRACE_LENGTH];
+};
+
+struct SlimTraceCache {
+    u32_t counters[SLIM_TRACE_COUNTERS];
+    SlimTrace traces[SLIM_TRACE_CACHE_SIZE];
+
+    u8_t recording;
+    SlimTrace recorded;
+};
+
+SlimTraceCache* slim_trace_cache_create();
+void slim_trace_cache_destroy(SlimTraceCache* cache);
+void slim_trace_cache_flush(SlimTraceCache* cache);
+SlimTrace* slim_trace_lookup(SlimTraceCache* cache, u32_t address);
+u32_t slim_trace_run(SlimMachine* machine, SlimTrace* trace);
+void slim_trace_observe(SlimMachine* machine, u32_t address, SlimInstruction instruction);
+
 // Debugging and Diagnostics -------------------------------------------------------------------------------------------
 void slim_machine_dump_stack(SlimMachine* machine);
 void slim_machine_dump_registers(SlimMachine* machine);
-void slim_machine_dump_memory(SlimMachine* machine);
\ No newline at end of file
+void slim_machine_dump_memory(SlimMachine* machine);
+
+// Merging sums the counters and keeps the worst of the high-water mark, largest free block and fragmentation
+void slim_machine_stats(SlimMachine* machine, SlimStats* stats);
+void slim_stats_merge(SlimStats* into, const SlimStats* from);
+void slim_stats_export(const SlimStats* stats, FILE* out);
\ No newline at end of file
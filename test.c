@@ -1,4 +1,1545 @@
 #include "slim.h"
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Checks --------------------------------------------------------------------------------------------------------------
+// Failures are reported on stderr, stdout carries the machine's own tracing
+static u32_t slim_test_failures = 0;
+
+#define slim_check(condition)                                                                                          \
+    if (!(condition)) {                                                                                                \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                                  \
+        slim_test_failures++;                                                                                          \
+    }
+
+#define slim_test_length(program) (sizeof(program) / sizeof(program[0]))
+
+// A cleared machine with the program encoded and loaded, the machine owns the bytes
+static SlimMachine* slim_test_machine(const SlimInstruction* program, u32_t count) {
+    SlimMachine* machine = slim_machine_create();
+    slim_machine_clear(machine);
+
+    u8_t* data = malloc(count * SLIM_INSTRUCTION_SIZE);
+    for (u32_t i = 0; i < count; i++) {
+        slim_instruction_encode(data + i * SLIM_INSTRUCTION_SIZE, program[i]);
+    }
+
+    slim_machine_load(machine, data, count * SLIM_INSTRUCTION_SIZE);
+    return machine;
+}
+
+// Thread body launching a machine until it halts or fails
+static void* slim_test_thread(void* argument) {
+    SlimMachine* machine = argument;
+    for (;;) {
+        slim_machine_launch(machine);
+        if (machine->flags.halt || machine->flags.error) {
+            return NULL;
+        }
+        sched_yield();
+    }
+}
+
+// Natives -------------------------------------------------------------------------------------------------------------
+static u32_t slim_test_native_count = 0;
+
+static SlimError slim_test_native_mix(SlimMachine* machine, u64_t* args, u32_t count, u64_t* result) {
+    slim_test_native_count = count;
+    *result = args[0] * 31 + args[1];
+    return SL_ERROR_NONE;
+}
+
+static SlimError slim_test_native_sum(SlimMachine* machine, u64_t* args, u32_t count, u64_t* result) {
+    slim_test_native_count = count;
+    *result = 0;
+    for (u32_t i = 0; i < count; i++) {
+        *result += args[i];
+    }
+    return SL_ERROR_NONE;
+}
+
+static SlimError slim_test_native_fail(SlimMachine* machine, u64_t* args, u32_t count, u64_t* result) {
+    *result = 99;
+    return SL_ERROR_INVALID_ADDRESS;
+}
+
+static void slim_test_natives(void) {
+    // Stack arguments arrive deepest first and are replaced by the result
+    SlimInstruction call[] = {
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_LOADI, 0, 4},
+        {SL_OPCODE_NATIVE, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(call, slim_test_length(call));
+    slim_check(slim_machine_register_native(machine, 0, slim_test_native_mix, 2) == SL_ERROR_NONE);
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+    slim_check(slim_test_native_count == 2);
+    slim_check(machine->stack_pointer == 1);
+    slim_check(machine->stack[0] == 3 * 31 + 4);
+    slim_check(machine->stack[1] == 0);
+    slim_machine_destroy(machine);
+
+    // Memory arguments are a range, the length is pushed below the address
+    SlimInstruction range[] = {
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_NATIVEM, 1, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(range, slim_test_length(range));
+    slim_check(slim_machine_register_native(machine, 1, slim_test_native_sum, 0) == SL_ERROR_NONE);
+    machine->memory[2] = 5, machine->memory[3] = 6, machine->memory[4] = 7, machine->memory[5] = 100;
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+    slim_check(slim_test_native_count == 3);
+    slim_check(machine->stack_pointer == 1);
+    slim_check(machine->stack[0] == 18);
+    slim_machine_destroy(machine);
+
+    // A failing native raises its error and leaves its arguments in place
+    SlimInstruction fail[] = {
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_NATIVE, 2, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(fail, slim_test_length(fail));
+    slim_check(slim_machine_register_native(machine, 2, slim_test_native_fail, 1) == SL_ERROR_NONE);
+    slim_machine_launch(machine);
+    slim_check(machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_INVALID_ADDRESS] == 1);
+    slim_check(machine->stack_pointer == 1);
+    slim_check(machine->stack[0] == 3);
+    slim_machine_destroy(machine);
+
+    // Unregistered natives, missing arguments and out of range memory are errors
+    SlimInstruction invalid[] = {
+        {SL_OPCODE_NATIVE, 5, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_NATIVE, 0, 0},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_LOADI, 0, SLIM_MACHINE_MEMORY_SIZE},
+        {SL_OPCODE_NATIVEM, 1, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(invalid, slim_test_length(invalid));
+    slim_check(slim_machine_register_native(machine, 0, slim_test_native_mix, 2) == SL_ERROR_NONE);
+    slim_check(slim_machine_register_native(machine, 1, slim_test_native_sum, 0) == SL_ERROR_NONE);
+    slim_machine_launch(machine);
+    slim_check(machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_INVALID_NATIVE] == 1);
+    slim_check(machine->stats.faults[SL_ERROR_STACK_UNDERFLOW] == 1);
+    slim_check(machine->stats.faults[SL_ERROR_INVALID_ADDRESS] == 1);
+    slim_check(machine->stack_pointer == 1);
+    slim_check(machine->stack[0] == 1);
+    slim_machine_destroy(machine);
+
+    machine = slim_machine_create();
+    slim_check(slim_machine_register_native(machine, SLIM_MACHINE_NATIVES, slim_test_native_sum, 0) ==
+               SL_ERROR_INVALID_NATIVE);
+    slim_check(slim_machine_register_native(machine, 0, slim_test_native_sum, SLIM_MACHINE_STACK_SIZE + 1) ==
+               SL_ERROR_STACK_OVERFLOW);
+    slim_machine_destroy(machine);
+}
+
+// Clearing and Pooling ------------------------------------------------------------------------------------------------
+static void slim_test_pool(void) {
+    // Leaves something behind in every part of the execution state
+    SlimInstruction dirty[] = {
+        {SL_OPCODE_LOADI, 0, 7},
+        {SL_OPCODE_STORER, 1, 0},
+        {SL_OPCODE_LOADI, 0, 9},
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_STOREM, 0, 0},
+        {SL_OPCODE_ALLOC, 4, 0},
+        {SL_OPCODE_HNEW, 4, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_NATIVE, 9, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachinePool* pool = slim_machine_pool_create(1);
+    SlimMachine* machine = slim_test_machine(dirty, slim_test_length(dirty));
+    slim_machine_launch(machine);
+    slim_check(machine->flags.error && machine->flags.halt);
+    slim_check(machine->stack_pointer == 3);
+    slim_check(machine->registers[1] == 7);
+    slim_check(machine->memory[3] == 9);
+    slim_check(machine->blocks->allocated);
+    slim_check(machine->tables[0] != NULL);
+    slim_check(machine->stats.instructions == 10 && machine->stats.faults[SL_ERROR_INVALID_NATIVE] == 1);
+    u64_t address = machine->stack[0];
+
+    slim_machine_pool_release(pool, machine);
+    SlimMachine* reused = slim_machine_pool_acquire(pool);
+    slim_check(reused == machine);
+    slim_check(reused->stack_pointer == 0);
+    slim_check(reused->instruction_pointer == 0);
+    slim_check(!reused->flags.error && !reused->flags.halt && !reused->flags.wait);
+    for (u32_t i = 0; i < SLIM_MACHINE_STACK_SIZE; i++) {
+        slim_check(reused->stack[i] == 0);
+    }
+    for (u32_t i = 0; i < SLIM_MACHINE_REGISTERS; i++) {
+        slim_check(reused->registers[i] == 0);
+    }
+    for (u32_t i = 0; i < SLIM_MACHINE_MEMORY_SIZE; i++) {
+        slim_check(reused->memory[i] == 0);
+    }
+    slim_check(reused->memory_high == 0);
+    SlimStats stats;
+    slim_machine_stats(reused, &stats);
+    slim_check(stats.machines == 1 && stats.instructions == 0 && stats.stack_high == 0);
+    slim_check(stats.allocs == 0 && stats.frees == 0 && stats.faults[SL_ERROR_INVALID_NATIVE] == 0);
+    slim_check(!reused->blocks->allocated && reused->blocks->next == NULL);
+    slim_check(reused->blocks->end == SLIM_MACHINE_MEMORY_SIZE);
+    for (u32_t i = 0; i < SLIM_MACHINE_TABLES; i++) {
+        slim_check(reused->tables[i] == NULL);
+    }
+
+    // The program stays bound and runs the same way again
+    slim_machine_launch(reused);
+    slim_check(reused->stack_pointer == 3);
+    slim_check(reused->stack[0] == address);
+    slim_check(reused->memory[3] == 9);
+
+    slim_machine_pool_release(pool, reused);
+    slim_machine_pool_destroy(pool);
+
+    // A pool that keeps nothing still creates
+    pool = slim_machine_pool_create(0);
+    slim_check(pool != NULL && pool->capacity == 0);
+    slim_machine_pool_destroy(pool);
+}
+
+// Channels ------------------------------------------------------------------------------------------------------------
+#define SLIM_TEST_PRODUCERS 4
+#define SLIM_TEST_PRODUCED 2000
+
+static void slim_test_channels(void) {
+    // Values come out in the order they went in, batches are all or nothing
+    SlimChannel* channel = slim_channel_create(3, SL_CHANNEL_SPSC);
+    slim_check(channel->capacity == 4);
+    u64_t values[4] = {1, 2, 3, 4};
+    u64_t received[4] = {0};
+    slim_check(slim_channel_send(channel, values, 1) == 1);
+    slim_check(slim_channel_send(channel, values + 1, 2) == 2);
+    slim_check(slim_channel_send(channel, values + 3, 2) == 0);
+    slim_check(slim_channel_send(channel, values + 3, 1) == 1);
+    slim_check(slim_channel_send(channel, values, 1) == 0);
+    slim_check(slim_channel_receive(channel, received, 3) == 3);
+    slim_check(slim_channel_receive(channel, received + 3, 2) == 0);
+    slim_check(slim_channel_receive(channel, received + 3, 1) == 1);
+    slim_check(slim_channel_receive(channel, received, 1) == 0);
+    for (u32_t i = 0; i < 4; i++) {
+        slim_check(received[i] == values[i]);
+    }
+    slim_check(slim_channel_send(channel, values, 5) == 0);
+
+    // A full or empty channel makes the machine wait on the instruction, a missing one is an error
+    SlimInstruction blocked[] = {
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_SEND, 0, 0},
+        {SL_OPCODE_RECV, 1, 0},
+        {SL_OPCODE_TRYRECV, 1, 0},
+        {SL_OPCODE_SEND, 2, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimChannel* empty = slim_channel_create(4, SL_CHANNEL_SPSC);
+    SlimMachine* machine = slim_test_machine(blocked, slim_test_length(blocked));
+    slim_check(slim_machine_attach_channel(machine, 0, channel) == SL_ERROR_NONE);
+    slim_check(slim_machine_attach_channel(machine, 1, empty) == SL_ERROR_NONE);
+    slim_check(slim_machine_attach_channel(machine, SLIM_MACHINE_CHANNELS, empty) == SL_ERROR_INVALID_CHANNEL);
+    slim_check(slim_channel_send(channel, values, 4) == 4);
+
+    slim_machine_launch(machine);
+    slim_check(machine->flags.wait && !machine->flags.error);
+    slim_check(machine->instruction_pointer == 1 * SLIM_INSTRUCTION_SIZE);
+    slim_check(machine->stack_pointer == 1);
+
+    slim_check(slim_channel_receive(channel, received, 1) == 1);
+    slim_machine_launch(machine);
+    slim_check(machine->flags.wait && !machine->flags.error);
+    slim_check(machine->instruction_pointer == 2 * SLIM_INSTRUCTION_SIZE);
+    slim_check(machine->stack_pointer == 0);
+
+    slim_check(slim_channel_send(empty, values + 2, 1) == 1);
+    slim_machine_launch(machine);
+    slim_check(machine->flags.halt && machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_INVALID_CHANNEL] == 1);
+    slim_check(machine->stack_pointer == 3);
+    slim_check(machine->stack[0] == 3 && machine->stack[1] == 0 && machine->stack[2] == 0);
+    slim_machine_destroy(machine);
+    slim_channel_destroy(empty);
+    slim_channel_destroy(channel);
+
+    // Machines on their own threads share one multi-producer channel, every value arrives once and each producer's
+    // values arrive in the order it sent them. Each sends base + n for n counting down from SLIM_TEST_PRODUCED to 1.
+    SlimInstruction produce[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_PRODUCED},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_ADD, 0, 0},
+        {SL_OPCODE_SEND, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    channel = slim_channel_create(8, SL_CHANNEL_MPSC);
+    SlimMachine* producers[SLIM_TEST_PRODUCERS];
+    pthread_t threads[SLIM_TEST_PRODUCERS];
+    u64_t last[SLIM_TEST_PRODUCERS];
+    for (u32_t i = 0; i < SLIM_TEST_PRODUCERS; i++) {
+        produce[3].arg1 = i + 1;
+        producers[i] = slim_test_machine(produce, slim_test_length(produce));
+        slim_machine_attach_channel(producers[i], 0, channel);
+        last[i] = SLIM_TEST_PRODUCED + 1;
+        pthread_create(&threads[i], NULL, slim_test_thread, producers[i]);
+    }
+
+    u64_t total = 0;
+    u8_t ordered = 1;
+    for (u32_t count = 0; count < SLIM_TEST_PRODUCERS * SLIM_TEST_PRODUCED;) {
+        u64_t value;
+        if (slim_channel_receive(channel, &value, 1) == 0) {
+            sched_yield();
+            continue;
+        }
+
+        u64_t producer = (value >> 32) - 1;
+        if (producer >= SLIM_TEST_PRODUCERS || (u32_t)value >= last[producer]) {
+            ordered = 0;
+            break;
+        }
+
+        last[producer] = (u32_t)value;
+        total += (u32_t)value;
+        count++;
+    }
+    slim_check(ordered);
+    slim_check(total == (u64_t)SLIM_TEST_PRODUCERS * SLIM_TEST_PRODUCED * (SLIM_TEST_PRODUCED + 1) / 2);
+
+    for (u32_t i = 0; i < SLIM_TEST_PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+        slim_check(!producers[i]->flags.error && last[i] == 1);
+        slim_machine_destroy(producers[i]);
+    }
+    slim_check(slim_channel_receive(channel, received, 1) == 0);
+    slim_channel_destroy(channel);
+}
+
+// Spawn and Join ------------------------------------------------------------------------------------------------------
+// Runs until halt, sleeping whenever the machine has to wait on a channel
+static void slim_test_run(SlimMachine* machine) {
+    for (;;) {
+        slim_machine_launch(machine);
+        if (machine->flags.halt) {
+            return;
+        }
+        slim_machine_park(machine);
+    }
+}
+
+static void slim_test_spawn_on(SlimScheduler* scheduler) {
+    // Children square their argument, JOIN pushes the results in spawn order
+    SlimInstruction squares[] = {
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_SPAWN, 9 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_SPAWN, 9 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_SPAWN, 9 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_JOIN, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_MUL, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(squares, slim_test_length(squares));
+    slim_machine_attach_scheduler(machine, scheduler);
+    slim_test_run(machine);
+    slim_check(!machine->flags.error);
+    slim_check(machine->child_count == 0);
+    slim_check(machine->stack_pointer == 3);
+    slim_check(machine->stack[0] == 1 && machine->stack[1] == 4 && machine->stack[2] == 9);
+    slim_machine_destroy(machine);
+
+    // The child waits on a channel its parent only feeds after SPAWN, then answers on another one before JOIN
+    SlimInstruction talk[] = {
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_SPAWN, 7 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 7},
+        {SL_OPCODE_SEND, 0, 0},
+        {SL_OPCODE_RECV, 1, 0},
+        {SL_OPCODE_JOIN, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_RECV, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_ADD, 0, 0},
+        {SL_OPCODE_SEND, 1, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimChannel* down = slim_channel_create(1, SL_CHANNEL_SPSC);
+    SlimChannel* up = slim_channel_create(1, SL_CHANNEL_SPSC);
+    machine = slim_test_machine(talk, slim_test_length(talk));
+    slim_machine_attach_scheduler(machine, scheduler);
+    slim_machine_attach_channel(machine, 0, down);
+    slim_machine_attach_channel(machine, 1, up);
+    slim_test_run(machine);
+    slim_check(!machine->flags.error);
+    slim_check(machine->stack_pointer == 2);
+    slim_check(machine->stack[0] == 8 && machine->stack[1] == 0);
+    slim_machine_destroy(machine);
+    slim_channel_destroy(down);
+    slim_channel_destroy(up);
+
+    // Spawning past the child limit is an error, the children already started are still joined
+    SlimInstruction many[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_MACHINE_CHILDREN + 1},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SPAWN, 12 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_JOIN, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(many, slim_test_length(many));
+    slim_machine_attach_scheduler(machine, scheduler);
+    slim_test_run(machine);
+    slim_check(machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_SPAWN] == 1);
+    slim_check(machine->child_count == 0);
+    slim_check(machine->stack_pointer == SLIM_MACHINE_CHILDREN);
+    slim_check(machine->stack[0] == SLIM_MACHINE_CHILDREN + 1 && machine->stack[SLIM_MACHINE_CHILDREN - 1] == 2);
+    slim_machine_destroy(machine);
+}
+
+static void slim_test_spawn(void) {
+    slim_test_spawn_on(NULL);
+
+    SlimScheduler* scheduler = slim_scheduler_create(2);
+    slim_test_spawn_on(scheduler);
+    slim_scheduler_destroy(scheduler);
+
+    // A single worker has to run the child itself while its parent task is parked on the channel
+    scheduler = slim_scheduler_create(1);
+    slim_test_spawn_on(scheduler);
+    slim_scheduler_destroy(scheduler);
+
+    // Loading other bytecode waits for children still running the old one and discards them
+    SlimInstruction orphan[] = {
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_SPAWN, 3 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(orphan, slim_test_length(orphan));
+    slim_machine_launch(machine);
+    slim_check(machine->child_count == 1);
+    u8_t* old = machine->bytecode;
+    u8_t* data = malloc(SLIM_INSTRUCTION_SIZE);
+    slim_instruction_encode(data, orphan[2]);
+    slim_machine_load(machine, data, SLIM_INSTRUCTION_SIZE);
+    slim_check(machine->child_count == 0);
+    free(old);
+    slim_machine_destroy(machine);
+}
+
+// Shared Segments -----------------------------------------------------------------------------------------------------
+#define SLIM_TEST_WORKERS 4
+#define SLIM_TEST_ADDS 5000
+
+static void slim_test_segments(void) {
+    SlimSegment* segment = slim_segment_create(1024);
+    SlimSegmentCache* cache = calloc(1, sizeof(SlimSegmentCache));
+    u32_t small, medium, large, other;
+
+    // Sizes round up to a power of two, blocks of different classes never overlap
+    slim_check(slim_segment_alloc(segment, cache, 1, &small) == SL_ERROR_NONE);
+    slim_check(slim_segment_alloc(segment, cache, 3, &medium) == SL_ERROR_NONE);
+    slim_check(slim_segment_alloc(segment, cache, 16, &large) == SL_ERROR_NONE);
+    slim_check(segment->classes[small] == 0 && segment->classes[medium] == 2 && segment->classes[large] == 4);
+    slim_check(small + 1 <= medium && medium + 4 <= large);
+    slim_check(slim_segment_alloc(segment, cache, 1u << SLIM_SEGMENT_CLASSES, &other) == SL_ERROR_SEGMENT);
+
+    // A freed block is handed out again for its own class only, with all of its words cleared
+    atomic_store(&segment->words[medium], 77);
+    atomic_store(&segment->words[medium + 1], 78);
+    slim_check(slim_segment_free(segment, cache, medium) == SL_ERROR_NONE);
+    slim_check(slim_segment_alloc(segment, cache, 1, &other) == SL_ERROR_NONE);
+    slim_check(other != medium);
+    slim_check(slim_segment_alloc(segment, cache, 4, &other) == SL_ERROR_NONE);
+    slim_check(other == medium);
+    slim_check(atomic_load(&segment->words[medium]) == 0);
+    slim_check(atomic_load(&segment->words[medium + 1]) == 0);
+
+    // Blocks going through the shared free list come back cleared too, every word of them
+    atomic_store(&segment->words[large + 15], 79);
+    slim_check(slim_segment_free(segment, NULL, large) == SL_ERROR_NONE);
+    slim_check(atomic_load(&segment->words[large]) == SLIM_SEGMENT_NULL);
+    slim_check(slim_segment_alloc(segment, NULL, 9, &other) == SL_ERROR_NONE);
+    slim_check(other == large);
+    slim_check(atomic_load(&segment->words[large]) == 0);
+    slim_check(atomic_load(&segment->words[large + 15]) == 0);
+
+    // Double frees and addresses that are not a block start are rejected
+    slim_check(slim_segment_free(segment, cache, small) == SL_ERROR_NONE);
+    slim_check(slim_segment_free(segment, cache, small) == SL_ERROR_INVALID_ADDRESS);
+    slim_check(slim_segment_free(segment, NULL, small) == SL_ERROR_INVALID_ADDRESS);
+    slim_check(slim_segment_free(segment, cache, large + 1) == SL_ERROR_INVALID_ADDRESS);
+    slim_check(slim_segment_free(segment, cache, segment->size) == SL_ERROR_INVALID_ADDRESS);
+
+    // Flushed blocks are visible to other caches
+    SlimSegmentCache* second = calloc(1, sizeof(SlimSegmentCache));
+    slim_segment_flush(segment, cache);
+    for (u32_t class = 0; class < SLIM_SEGMENT_CLASSES; class++) {
+        slim_check(cache->count[class] == 0);
+    }
+    slim_check(slim_segment_alloc(segment, second, 1, &other) == SL_ERROR_NONE);
+    slim_check(other == small);
+    slim_segment_flush(segment, second);
+    free(second);
+    free(cache);
+    slim_segment_destroy(segment);
+
+    // Machines on their own threads add to the same word, none of the additions are lost
+    SlimInstruction add[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_ADDS},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_FETCH_ADD, 3, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    segment = slim_segment_create(64);
+    SlimMachine* workers[SLIM_TEST_WORKERS];
+    pthread_t threads[SLIM_TEST_WORKERS];
+    for (u32_t i = 0; i < SLIM_TEST_WORKERS; i++) {
+        workers[i] = slim_test_machine(add, slim_test_length(add));
+        slim_machine_map_segment(workers[i], segment);
+        pthread_create(&threads[i], NULL, slim_test_thread, workers[i]);
+    }
+    for (u32_t i = 0; i < SLIM_TEST_WORKERS; i++) {
+        pthread_join(threads[i], NULL);
+        slim_check(!workers[i]->flags.error);
+        slim_machine_destroy(workers[i]);
+    }
+    slim_check(atomic_load(&segment->words[3]) == SLIM_TEST_WORKERS * SLIM_TEST_ADDS);
+
+    // CAS only swaps on a match and reports what it found, XCHG hands back the old word, SFREE catches double frees
+    SlimInstruction atomics[] = {
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_CAS, 0, 0},
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_LOADI, 0, 6},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_CAS, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_LOADI, 0, 9},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_XCHG, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADM_ACQ, 0, 0},
+        {SL_OPCODE_SALLOC, 2, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_SFREE, 0, 0},
+        {SL_OPCODE_SFREE, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(atomics, slim_test_length(atomics));
+    slim_machine_map_segment(machine, segment);
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+    slim_check(machine->stack_pointer == 4);
+    slim_check(machine->stack[0] == 0 && machine->stack[1] == 1);
+    slim_check(machine->stack[2] == 5 && machine->stack[3] == 0);
+    slim_check(atomic_load(&segment->words[1]) == 5);
+
+    machine->stack_pointer = 0;
+    machine->flags.halt = 0;
+    slim_machine_launch(machine);
+    slim_check(machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_INVALID_ADDRESS] == 1);
+    slim_check(machine->stack_pointer == 2);
+    slim_check(machine->stack[0] == 5 && machine->stack[1] == 9);
+    slim_machine_destroy(machine);
+    slim_segment_destroy(segment);
+}
+
+// Streams -------------------------------------------------------------------------------------------------------------
+// A temporary file for the test to write, the name is returned in path
+static int slim_test_file(char* path) {
+    strcpy(path, "/tmp/slim-test-XXXXXX");
+    return mkstemp(path);
+}
+
+static void slim_test_streams(void) {
+    char written[32];
+    char copied[32];
+    int output = slim_test_file(written);
+    int copy = slim_test_file(copied);
+
+    // Output is batched until the stream is flushed
+    SlimInstruction write[] = {
+        {SL_OPCODE_LOADI, 0, 0x0A636261},
+        {SL_OPCODE_WRITE, 0, 4},
+        {SL_OPCODE_LOADI, 0, 0x0A6564},
+        {SL_OPCODE_WRITE, 0, 3},
+        {SL_OPCODE_LOADI, 0, 0x4766},
+        {SL_OPCODE_WRITE, 0, 1},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimStream* stream = slim_stream_create(output, 64);
+    SlimMachine* machine = slim_test_machine(write, slim_test_length(write));
+    slim_check(slim_machine_attach_stream(machine, 0, stream) == SL_ERROR_NONE);
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+
+    struct stat info;
+    fstat(output, &info);
+    slim_check(info.st_size == 0);
+    slim_stream_destroy(stream);
+    fstat(output, &info);
+    slim_check(info.st_size == 8);
+    slim_machine_destroy(machine);
+
+    // Lines are handed out as windows into the input and copied to the output, the end of input pushes 0 0 0
+    SlimInstruction lines[] = {
+        {SL_OPCODE_READLINE, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_SWAP, 0, 0},
+        {SL_OPCODE_WRITEW, 1, 0},
+        {SL_OPCODE_READLINE, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_SWAP, 0, 0},
+        {SL_OPCODE_WRITEW, 1, 0},
+        {SL_OPCODE_READLINE, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_SWAP, 0, 0},
+        {SL_OPCODE_WRITEW, 1, 0},
+        {SL_OPCODE_READLINE, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimStream* input = slim_stream_open(written);
+    SlimStream* target = slim_stream_create(copy, 64);
+    slim_check(input != NULL && input->size == 8);
+    machine = slim_test_machine(lines, slim_test_length(lines));
+    slim_machine_attach_stream(machine, 0, input);
+    slim_machine_attach_stream(machine, 1, target);
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+    slim_check(machine->stack_pointer == 3);
+    slim_check(machine->stack[0] == 0 && machine->stack[1] == 0 && machine->stack[2] == 0);
+    slim_stream_destroy(target);
+    slim_stream_destroy(input);
+    slim_machine_destroy(machine);
+
+    char text[16] = {0};
+    slim_check(pread(copy, text, sizeof(text), 0) == 6);
+    slim_check(strcmp(text, "abcdef") == 0);
+
+    // Words are read little endian, a short read at the end counts only the bytes there were, then 0 at the end
+    SlimInstruction words[] = {
+        {SL_OPCODE_READ, 0, 0},
+        {SL_OPCODE_READ, 0, 0},
+        {SL_OPCODE_LOADI, 0, 4},
+        {SL_OPCODE_PEEK, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_LOADI, 0, 8},
+        {SL_OPCODE_PEEK, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_WRITE, 0, 9},
+        {SL_OPCODE_READ, 2, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    input = slim_stream_open(written);
+    machine = slim_test_machine(words, slim_test_length(words));
+    slim_machine_attach_stream(machine, 0, input);
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+    slim_check(machine->stack_pointer == 5);
+    slim_check(machine->stack[0] == 0x660A65640A636261 && machine->stack[1] == 8);
+    slim_check(machine->stack[2] == 0 && machine->stack[3] == 0);
+    slim_check(machine->stack[4] == 'd');
+
+    // Reading past the window, oversized writes and missing streams are errors
+    machine->stack_pointer = 0;
+    machine->flags.halt = 0;
+    slim_machine_launch(machine);
+    slim_check(machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_INVALID_ADDRESS] == 1);
+    slim_check(machine->stats.faults[SL_ERROR_STREAM] == 2);
+    slim_check(slim_machine_attach_stream(machine, SLIM_MACHINE_STREAMS, input) == SL_ERROR_STREAM);
+    slim_stream_destroy(input);
+    slim_machine_destroy(machine);
+
+    slim_check(slim_stream_open("/nonexistent/slim-test") == NULL);
+
+    close(output);
+    close(copy);
+    unlink(written);
+    unlink(copied);
+}
+
+// Hash Tables ---------------------------------------------------------------------------------------------------------
+#define SLIM_TEST_KEYS 5000
+#define SLIM_TEST_LIVE 30
+
+// Spreads consecutive indices over the key space
+static u64_t slim_test_key(u64_t i) {
+    return i * 0x9E3779B97F4A7C15ULL;
+}
+
+static void slim_test_tables(void) {
+    // Inserting far past the initial capacity grows the table and keeps every key
+    SlimTable* table = slim_table_create(4);
+    slim_check(table->capacity == SLIM_TABLE_GROUP);
+    u8_t inserted;
+    u8_t all = 1;
+    for (u64_t i = 0; i < SLIM_TEST_KEYS; i++) {
+        all &= slim_table_put(table, slim_test_key(i), i, &inserted) == SL_ERROR_NONE && inserted;
+    }
+    slim_check(all);
+    slim_check(table->count == SLIM_TEST_KEYS);
+    slim_check(table->capacity >= SLIM_TEST_KEYS && (table->capacity & (table->capacity - 1)) == 0);
+
+    u64_t value;
+    for (u64_t i = 0; i < SLIM_TEST_KEYS; i++) {
+        all &= slim_table_get(table, slim_test_key(i), &value) && value == i;
+    }
+    slim_check(all);
+    slim_check(!slim_table_get(table, slim_test_key(SLIM_TEST_KEYS), &value));
+
+    // Putting an existing key replaces its value
+    slim_check(slim_table_put(table, slim_test_key(7), 70, &inserted) == SL_ERROR_NONE && !inserted);
+    slim_check(slim_table_get(table, slim_test_key(7), &value) && value == 70);
+    slim_check(table->count == SLIM_TEST_KEYS);
+
+    // Deleted keys are gone, the others stay
+    for (u64_t i = 0; i < SLIM_TEST_KEYS; i += 2) {
+        all &= slim_table_delete(table, slim_test_key(i));
+    }
+    slim_check(all);
+    slim_check(!slim_table_delete(table, slim_test_key(0)));
+    slim_check(table->count == SLIM_TEST_KEYS / 2);
+    for (u64_t i = 0; i < SLIM_TEST_KEYS; i++) {
+        all &= slim_table_get(table, slim_test_key(i), &value) == (i % 2);
+    }
+    slim_check(all);
+    slim_table_destroy(table);
+
+    // A sliding window of live keys leaves tombstones behind, inserts reuse them and the table never grows while
+    // it stays under half full
+    table = slim_table_create(SLIM_TEST_LIVE);
+    u32_t capacity = table->capacity;
+    u8_t reused = 0;
+    for (u64_t i = 0; i < SLIM_TEST_KEYS; i++) {
+        if (i >= SLIM_TEST_LIVE) {
+            all &= slim_table_delete(table, slim_test_key(i - SLIM_TEST_LIVE));
+        }
+
+        u32_t deleted = table->deleted;
+        all &= slim_table_put(table, slim_test_key(i), i, &inserted) == SL_ERROR_NONE && inserted;
+        reused |= deleted > 0 && table->deleted == deleted - 1;
+    }
+    slim_check(all);
+    slim_check(reused);
+    slim_check(table->capacity == capacity);
+    slim_check(table->count == SLIM_TEST_LIVE);
+    for (u64_t i = 0; i < SLIM_TEST_KEYS; i++) {
+        all &= slim_table_get(table, slim_test_key(i), &value) == (i >= SLIM_TEST_KEYS - SLIM_TEST_LIVE);
+    }
+    slim_check(all);
+    slim_table_destroy(table);
+
+    // The opcodes work on handles kept on the stack
+    SlimInstruction opcodes[] = {
+        {SL_OPCODE_HNEW, 2, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_LOADI, 0, 10},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_HPUT, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_LOADI, 0, 11},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_HPUT, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_HGET, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_LOADI, 0, 6},
+        {SL_OPCODE_HGET, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_HDEL, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_HLEN, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_LOADI, 0, SLIM_MACHINE_TABLES},
+        {SL_OPCODE_HLEN, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(opcodes, slim_test_length(opcodes));
+    slim_machine_launch(machine);
+    slim_check(!machine->flags.error);
+    slim_check(machine->stack_pointer == 8);
+    slim_check(machine->stack[0] == 1 && machine->stack[1] == 0);
+    slim_check(machine->stack[2] == 11 && machine->stack[3] == 1);
+    slim_check(machine->stack[4] == 0 && machine->stack[5] == 0);
+    slim_check(machine->stack[6] == 1 && machine->stack[7] == 0);
+
+    machine->stack_pointer = 0;
+    machine->flags.halt = 0;
+    slim_machine_launch(machine);
+    slim_check(machine->flags.error);
+    slim_check(machine->stats.faults[SL_ERROR_TABLE] == 1);
+    slim_machine_destroy(machine);
+}
+
+// Telemetry -----------------------------------------------------------------------------------------------------------
+#define SLIM_TEST_LOOPS 1000
+
+static void slim_test_stats(void) {
+    // Nine instructions, one of them faulting, two allocations and a free of the second block
+    SlimInstruction known[] = {
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_ADD, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_ALLOC, 4, 0},
+        {SL_OPCODE_ALLOC, 2, 0},
+        {SL_OPCODE_FREE, 4, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(known, slim_test_length(known));
+    slim_machine_launch(machine);
+
+    SlimStats stats;
+    slim_machine_stats(machine, &stats);
+    slim_check(stats.machines == 1);
+    slim_check(stats.instructions == 9);
+    slim_check(stats.allocs == 2 && stats.frees == 1);
+    slim_check(stats.stack_high == 2);
+    slim_check(stats.faults[SL_ERROR_STACK_UNDERFLOW] == 1);
+    u64_t faults = 0;
+    for (u32_t i = 0; i < SL_ERROR_COUNT; i++) {
+        faults += stats.faults[i];
+    }
+    slim_check(faults == 1);
+    slim_check(stats.bytes_live == 4 * sizeof(u64_t));
+    slim_check(stats.bytes_live + stats.bytes_free == SLIM_MACHINE_MEMORY_SIZE * sizeof(u64_t));
+    slim_check(stats.largest_free == stats.bytes_free);
+    slim_check(stats.fragmentation == 0);
+
+    // The export is a single JSON object with every counter and one fault entry per error code
+    char* json = NULL;
+    size_t length = 0;
+    FILE* out = open_memstream(&json, &length);
+    slim_stats_export(&stats, out);
+    fclose(out);
+    slim_check(length > 2 && json[0] == '{' && strcmp(json + length - 2, "}\n") == 0);
+    slim_check(strstr(json, "\"machines\": 1, ") != NULL);
+    slim_check(strstr(json, "\"instructions\": 9, ") != NULL);
+    slim_check(strstr(json, "\"allocs\": 2, \"frees\": 1, ") != NULL);
+    slim_check(strstr(json, "\"stack_high\": 2, ") != NULL);
+    slim_check(strstr(json, "\"faults\": [0, 0, 1, 0") != NULL);
+    u32_t entries = 1;
+    for (const char* c = strstr(json, "\"faults\""); c != NULL && *c != ']'; c++) {
+        entries += *c == ',';
+    }
+    slim_check(entries == SL_ERROR_COUNT);
+    free(json);
+
+    // Merging adds the counters up
+    SlimStats merged = stats;
+    slim_stats_merge(&merged, &stats);
+    slim_check(merged.machines == 2 && merged.instructions == 18);
+    slim_check(merged.faults[SL_ERROR_STACK_UNDERFLOW] == 2);
+    slim_check(merged.stack_high == 2);
+    slim_machine_destroy(machine);
+
+    // Instructions retired by traces are counted exactly like interpreted ones
+    SlimInstruction loop[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_LOOPS},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    for (u32_t traced = 0; traced < 2; traced++) {
+        machine = slim_test_machine(loop, slim_test_length(loop));
+        if (!traced) {
+            slim_trace_cache_destroy(machine->traces);
+            machine->traces = NULL;
+        }
+        slim_machine_launch(machine);
+        slim_machine_stats(machine, &stats);
+        slim_check(stats.instructions == 3 + 6 * SLIM_TEST_LOOPS);
+        slim_check(stats.stack_high == 2);
+        slim_machine_destroy(machine);
+    }
+
+    // Children's work and faults show up in the parent once joined
+    SlimInstruction children[] = {
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_SPAWN, 6 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_SPAWN, 6 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_JOIN, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_DROP, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(children, slim_test_length(children));
+    slim_machine_launch(machine);
+    slim_machine_stats(machine, &stats);
+    slim_check(stats.machines == 3);
+    slim_check(stats.instructions == 6 + 2 * 3);
+    slim_check(stats.faults[SL_ERROR_STACK_UNDERFLOW] == 2);
+    slim_machine_destroy(machine);
+}
+
+// Tracing -------------------------------------------------------------------------------------------------------------
+// The same program with and without traces, launched from whatever state the caller set up
+static void slim_test_traced_like_plain(SlimMachine* traced, SlimMachine* plain) {
+    slim_trace_cache_destroy(plain->traces);
+    plain->traces = NULL;
+    slim_machine_launch(traced);
+    slim_machine_launch(plain);
+
+    slim_check(traced->flags.halt && plain->flags.halt);
+    slim_check(traced->flags.error == plain->flags.error);
+    slim_check(traced->instruction_pointer == plain->instruction_pointer);
+    slim_check(traced->stack_pointer == plain->stack_pointer);
+    slim_check(memcmp(traced->stack, plain->stack, sizeof(traced->stack)) == 0);
+    slim_check(memcmp(traced->registers, plain->registers, sizeof(traced->registers)) == 0);
+    slim_check(traced->stats.instructions == plain->stats.instructions);
+    slim_check(memcmp(traced->stats.faults, plain->stats.faults, sizeof(traced->stats.faults)) == 0);
+}
+
+// Back at the loop header with the given counter and nothing on the stack
+static void slim_test_trace_enter(SlimMachine* machine, u32_t header, u64_t counter) {
+    slim_machine_clear(machine);
+    machine->registers[0] = counter;
+    machine->instruction_pointer = header;
+}
+
+static void slim_test_traces(void) {
+    // Counts register 0 down, the JNE back to the header is recorded as taken
+    SlimInstruction down[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_LOOPS},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    SlimMachine* machine = slim_test_machine(down, slim_test_length(down));
+    SlimMachine* plain = slim_test_machine(down, slim_test_length(down));
+    slim_test_traced_like_plain(machine, plain);
+    slim_machine_destroy(plain);
+    SlimTrace* trace = slim_trace_lookup(machine->traces, 2 * SLIM_INSTRUCTION_SIZE);
+    slim_check(trace != NULL && trace->length == 6 && trace->stack_min == 0 && trace->stack_max == 2);
+
+    // The guard fails once the counter reaches zero and exits to the instruction after the JNE
+    slim_test_trace_enter(machine, 2 * SLIM_INSTRUCTION_SIZE, 3);
+    slim_check(trace != NULL && slim_trace_run(machine, trace) == 3 * 6);
+    slim_check(machine->instruction_pointer == 8 * SLIM_INSTRUCTION_SIZE);
+    slim_check(machine->registers[0] == 0 && machine->stack_pointer == 0);
+
+    // Without room for the body the trace doesn't run at all and the interpreter takes the header
+    slim_test_trace_enter(machine, 2 * SLIM_INSTRUCTION_SIZE, 3);
+    machine->stack_pointer = SLIM_MACHINE_STACK_SIZE - 1;
+    slim_check(trace != NULL && slim_trace_run(machine, trace) == 0);
+    slim_check(machine->instruction_pointer == 2 * SLIM_INSTRUCTION_SIZE);
+    slim_check(machine->stack_pointer == SLIM_MACHINE_STACK_SIZE - 1 && machine->stats.instructions == 0);
+
+    // Reloading the same buffer keeps the traces, a different one flushes them
+    slim_machine_load(machine, machine->bytecode, machine->bytecode_size);
+    slim_check(slim_trace_lookup(machine->traces, 2 * SLIM_INSTRUCTION_SIZE) != NULL);
+    u8_t* data = malloc(machine->bytecode_size);
+    memcpy(data, machine->bytecode, machine->bytecode_size);
+    free(machine->bytecode);
+    slim_machine_load(machine, data, machine->bytecode_size);
+    slim_check(slim_trace_lookup(machine->traces, 2 * SLIM_INSTRUCTION_SIZE) == NULL);
+    slim_machine_destroy(machine);
+
+    // Exits the loop through a JE recorded as not taken, so its guard exits to the jump target
+    SlimInstruction until[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_LOOPS},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_JE, 9 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JMP, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 7},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(until, slim_test_length(until));
+    plain = slim_test_machine(until, slim_test_length(until));
+    slim_test_traced_like_plain(machine, plain);
+    slim_machine_destroy(plain);
+    trace = slim_trace_lookup(machine->traces, 2 * SLIM_INSTRUCTION_SIZE);
+    slim_check(trace != NULL && trace->length == 7);
+
+    slim_test_trace_enter(machine, 2 * SLIM_INSTRUCTION_SIZE, 2);
+    slim_check(trace != NULL && slim_trace_run(machine, trace) == 2 * 7 + 2);
+    slim_check(machine->instruction_pointer == 9 * SLIM_INSTRUCTION_SIZE);
+    slim_check(machine->registers[0] == 0 && machine->stack_pointer == 0);
+    slim_machine_destroy(machine);
+
+    // The loop needs a value below the header, entered without one the interpreter faults exactly as it would alone
+    SlimInstruction below[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_LOOPS},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_SWAP, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_JNE, 1 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(below, slim_test_length(below));
+    plain = slim_test_machine(below, slim_test_length(below));
+    slim_test_traced_like_plain(machine, plain);
+    trace = slim_trace_lookup(machine->traces, 1 * SLIM_INSTRUCTION_SIZE);
+    slim_check(trace != NULL && trace->stack_min == -1);
+
+    slim_test_trace_enter(machine, 1 * SLIM_INSTRUCTION_SIZE, 0);
+    slim_test_trace_enter(plain, 1 * SLIM_INSTRUCTION_SIZE, 0);
+    slim_test_traced_like_plain(machine, plain);
+    slim_check(machine->stats.faults[SL_ERROR_STACK_UNDERFLOW] > 0);
+    slim_machine_destroy(plain);
+    slim_machine_destroy(machine);
+
+    // Natives run inside the trace with the machine in sync, register 1 folds every counter value
+    SlimInstruction fold[] = {
+        {SL_OPCODE_LOADI, 0, SLIM_TEST_LOOPS},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADR, 1, 0},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_NATIVE, 0, 0},
+        {SL_OPCODE_STORER, 1, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    machine = slim_test_machine(fold, slim_test_length(fold));
+    plain = slim_test_machine(fold, slim_test_length(fold));
+    slim_check(slim_machine_register_native(machine, 0, slim_test_native_mix, 2) == SL_ERROR_NONE);
+    slim_check(slim_machine_register_native(plain, 0, slim_test_native_mix, 2) == SL_ERROR_NONE);
+    slim_test_traced_like_plain(machine, plain);
+    trace = slim_trace_lookup(machine->traces, 2 * SLIM_INSTRUCTION_SIZE);
+    slim_check(trace != NULL && trace->entries[2].instruction.opcode == SL_OPCODE_NATIVE);
+    slim_machine_destroy(plain);
+    slim_machine_destroy(machine);
+
+    // An earlier recoverable fault leaves the error flag set, loops after it still get traced
+    SlimInstruction faulted[slim_test_length(down) + 1];
+    faulted[0] = (SlimInstruction){SL_OPCODE_DROP, 0, 0};
+    for (u32_t i = 0; i < slim_test_length(down); i++) {
+        faulted[i + 1] = down[i];
+        if (down[i].opcode == SL_OPCODE_JNE) {
+            faulted[i + 1].arg1 += SLIM_INSTRUCTION_SIZE;
+        }
+    }
+    machine = slim_test_machine(faulted, slim_test_length(faulted));
+    plain = slim_test_machine(faulted, slim_test_length(faulted));
+    slim_test_traced_like_plain(machine, plain);
+    slim_machine_destroy(plain);
+    slim_check(machine->flags.error && machine->stats.faults[SL_ERROR_STACK_UNDERFLOW] == 1);
+    slim_check(slim_trace_lookup(machine->traces, 3 * SLIM_INSTRUCTION_SIZE) != NULL);
+    slim_machine_destroy(machine);
+}
+
+// Ahead-of-Time Compilation -------------------------------------------------------------------------------------------
+// Run from the tree after build.sh, which builds slim-aot and exports the compiler it used
+static void slim_test_write(const char* path, const SlimInstruction* program, u32_t count) {
+    FILE* file = fopen(path, "wb");
+    for (u32_t i = 0; file != NULL && i < count; i++) {
+        u8_t record[SLIM_INSTRUCTION_SIZE];
+        slim_instruction_encode(record, program[i]);
+        fwrite(record, sizeof(record), 1, file);
+    }
+
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+// Compiled and interpreted runs from the same starting depth end in the same state
+static void slim_test_compiled_like_plain(const SlimInstruction* program, u32_t count, const char* object, u32_t depth) {
+    SlimMachine* compiled = slim_test_machine(program, count);
+    SlimMachine* plain = slim_test_machine(program, count);
+    slim_trace_cache_destroy(plain->traces);
+    plain->traces = NULL;
+    slim_check(slim_machine_load_object(compiled, object) == SL_ERROR_NONE);
+    compiled->stack_pointer = depth;
+    plain->stack_pointer = depth;
+
+    slim_machine_launch(compiled);
+    slim_machine_launch(plain);
+    slim_check(compiled->flags.halt && plain->flags.halt);
+    slim_check(compiled->flags.error == plain->flags.error);
+    slim_check(compiled->instruction_pointer == plain->instruction_pointer);
+    slim_check(compiled->stack_pointer == plain->stack_pointer);
+    slim_check(memcmp(compiled->stack, plain->stack, sizeof(compiled->stack)) == 0);
+    slim_check(memcmp(compiled->registers, plain->registers, sizeof(compiled->registers)) == 0);
+    slim_check(memcmp(compiled->memory, plain->memory, sizeof(compiled->memory)) == 0);
+    slim_check(compiled->stats.instructions == plain->stats.instructions);
+    slim_check(memcmp(compiled->stats.faults, plain->stats.faults, sizeof(compiled->stats.faults)) == 0);
+
+    slim_machine_destroy(plain);
+    slim_machine_destroy(compiled);
+}
+
+static void slim_test_aot(void) {
+    // A loop with a register counter, a memory store after it, and an ALLOC that goes through the interpreter's routine
+    SlimInstruction program[] = {
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 2 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_STOREM, 0, 0},
+        {SL_OPCODE_ALLOC, 2, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+
+    char directory[32];
+    strcpy(directory, "/tmp/slim-test-XXXXXX");
+    slim_check(mkdtemp(directory) != NULL);
+
+    char source[64], generated[64], object[64], command[512];
+    snprintf(source, sizeof(source), "%s/program.slx", directory);
+    snprintf(generated, sizeof(generated), "%s/program.c", directory);
+    snprintf(object, sizeof(object), "%s/program.so", directory);
+    snprintf(command, sizeof(command), "./slim-aot %s %s > /dev/null && ${CC:-cc} -shared -fPIC -I. %s -o %s",
+        source, generated, generated, object);
+    slim_test_write(source, program, slim_test_length(program));
+    slim_check(system(command) == 0);
+
+    slim_test_compiled_like_plain(program, slim_test_length(program), object, 0);
+
+    // Entered one short of a full stack, the loop body doesn't fit the first time round and steps through the
+    // interpreter, which raises the overflow, then runs compiled once there is room again
+    slim_test_compiled_like_plain(program, slim_test_length(program), object, SLIM_MACHINE_STACK_SIZE - 1);
+    SlimMachine* machine = slim_test_machine(program, slim_test_length(program));
+    slim_check(slim_machine_load_object(machine, object) == SL_ERROR_NONE);
+    machine->stack_pointer = SLIM_MACHINE_STACK_SIZE - 1;
+    slim_machine_launch(machine);
+    slim_check(machine->stats.faults[SL_ERROR_STACK_OVERFLOW] == 1);
+    slim_machine_destroy(machine);
+
+    // Objects only bind to the exact bytecode they were generated from, and only once it is loaded
+    SlimInstruction other[slim_test_length(program)];
+    memcpy(other, program, sizeof(program));
+    other[0].arg2 = 4;
+    machine = slim_test_machine(other, slim_test_length(other));
+    slim_check(slim_machine_load_object(machine, object) == SL_ERROR_OBJECT_LOAD);
+    slim_check(machine->entry == NULL && machine->object == NULL);
+    slim_machine_destroy(machine);
+
+    machine = slim_test_machine(program, slim_test_length(program) - 1);
+    slim_check(slim_machine_load_object(machine, object) == SL_ERROR_OBJECT_LOAD);
+    slim_machine_destroy(machine);
+
+    machine = slim_machine_create();
+    slim_check(slim_machine_load_object(machine, object) == SL_ERROR_OBJECT_LOAD);
+    slim_machine_destroy(machine);
+
+    unlink(source);
+    unlink(generated);
+    unlink(object);
+    rmdir(directory);
+}
+
+// Optimizer -----------------------------------------------------------------------------------------------------------
+#define SLIM_TEST_OPTIMIZED 32
+
+// Runs a program through slim-opt and both versions on the interpreter, returns the optimized instruction count. The
+// count of retired instructions is expected to drop, everything the program leaves behind has to stay the same.
+static u32_t slim_test_optimize(const SlimInstruction* program, u32_t count) {
+    char directory[32];
+    strcpy(directory, "/tmp/slim-test-XXXXXX");
+    slim_check(mkdtemp(directory) != NULL);
+
+    char source[64], optimized[64], command[256];
+    snprintf(source, sizeof(source), "%s/program.slx", directory);
+    snprintf(optimized, sizeof(optimized), "%s/program.opt.slx", directory);
+    snprintf(command, sizeof(command), "./slim-opt %s %s > /dev/null", source, optimized);
+    slim_test_write(source, program, count);
+    slim_check(system(command) == 0);
+
+    SlimInstruction rewritten[SLIM_TEST_OPTIMIZED];
+    u8_t record[SLIM_INSTRUCTION_SIZE];
+    u32_t length = 0;
+    FILE* file = fopen(optimized, "rb");
+    while (file != NULL && length < SLIM_TEST_OPTIMIZED && fread(record, sizeof(record), 1, file) == 1) {
+        rewritten[length++] = slim_instruction_decode(record);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    SlimMachine* before = slim_test_machine(program, count);
+    SlimMachine* after = slim_test_machine(rewritten, length);
+    slim_machine_launch(before);
+    slim_machine_launch(after);
+    slim_check(before->flags.halt && after->flags.halt);
+    slim_check(before->flags.error == after->flags.error);
+    slim_check(before->stack_pointer == after->stack_pointer);
+    slim_check(memcmp(before->stack, after->stack, sizeof(before->stack)) == 0);
+    slim_check(memcmp(before->registers, after->registers, sizeof(before->registers)) == 0);
+    slim_check(memcmp(before->memory, after->memory, sizeof(before->memory)) == 0);
+    slim_check(after->stats.instructions <= before->stats.instructions);
+    slim_machine_destroy(after);
+    slim_machine_destroy(before);
+
+    unlink(source);
+    unlink(optimized);
+    rmdir(directory);
+    return length;
+}
+
+static void slim_test_optimizer(void) {
+    // Arithmetic and SWAP on constants fold into single LOADIs, NOOPs go away
+    SlimInstruction folding[] = {
+        {SL_OPCODE_LOADI, 0, 6},
+        {SL_OPCODE_LOADI, 0, 20},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_LOADI, 0, 4},
+        {SL_OPCODE_SWAP, 0, 0},
+        {SL_OPCODE_MUL, 0, 0},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_LOADI, 0, 8},
+        {SL_OPCODE_DIV, 0, 0},
+        {SL_OPCODE_NOOP, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    slim_check(slim_test_optimize(folding, slim_test_length(folding)) == 4);
+
+    // Constant conditions become a JMP or disappear, the code they skip is unreachable
+    SlimInstruction branches[] = {
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_JNE, 6 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 0},
+        {SL_OPCODE_JE, 5 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADI, 0, 2},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    slim_check(slim_test_optimize(branches, slim_test_length(branches)) == 2);
+
+    // A register stored from a constant is read back as the constant, its store stays for whoever runs next
+    SlimInstruction registers[] = {
+        {SL_OPCODE_LOADI, 0, 7},
+        {SL_OPCODE_STORER, 2, 0},
+        {SL_OPCODE_LOADR, 2, 0},
+        {SL_OPCODE_LOADR, 2, 0},
+        {SL_OPCODE_ADD, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    slim_check(slim_test_optimize(registers, slim_test_length(registers)) == 4);
+
+    // A store overwritten before any read becomes a DROP, the last one survives
+    SlimInstruction stores[] = {
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADI, 0, 9},
+        {SL_OPCODE_ADD, 0, 0},
+        {SL_OPCODE_LOADR, 3, 0},
+        {SL_OPCODE_SWAP, 0, 0},
+        {SL_OPCODE_STORER, 1, 0},
+        {SL_OPCODE_STORER, 1, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    slim_check(slim_test_optimize(stores, slim_test_length(stores)) == 6);
+
+    // Blocks nothing jumps to are removed along with the JMP around them, loops and their exits are kept intact
+    SlimInstruction unreachable[] = {
+        {SL_OPCODE_LOADI, 0, 4},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JMP, 5 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 99},
+        {SL_OPCODE_STORER, 1, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 5 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_LOADI, 0, 5},
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_STOREM, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    slim_check(slim_test_optimize(unreachable, slim_test_length(unreachable)) == 12);
+}
+
+// Modules -------------------------------------------------------------------------------------------------------------
+#define SLIM_TEST_MODULE_SIZE (3 * SLIM_INSTRUCTION_SIZE + 2 * SLIM_INSTRUCTION_SIZE)
+#define SLIM_TEST_LIBRARY_SIZE (14 * SLIM_INSTRUCTION_SIZE)
+
+static void slim_test_u32(FILE* out, u32_t value) {
+    u8_t data[4] = {value >> 24, value >> 16, value >> 8, value};
+    fwrite(data, sizeof(data), 1, out);
+}
+
+static void slim_test_name(FILE* out, const char* name) {
+    char data[SLIM_MODULE_NAME_SIZE] = {0};
+    strncpy(data, name, SLIM_MODULE_NAME_SIZE - 1);
+    fwrite(data, sizeof(data), 1, out);
+}
+
+// Writes a .slm the way slim-mod packs one, function i covers bounds[i] up to bounds[i + 1]
+static void slim_test_module(const char* path, const SlimInstruction* program, u32_t count, const char** functions,
+    const u32_t* bounds, u32_t function_count, const char** imports, u32_t import_count) {
+    FILE* out = fopen(path, "wb");
+    slim_test_u32(out, SLIM_MODULE_MAGIC);
+    slim_test_u32(out, SLIM_VERSION);
+    slim_test_u32(out, function_count);
+    slim_test_u32(out, import_count);
+    slim_test_u32(out, count * SLIM_INSTRUCTION_SIZE);
+
+    for (u32_t i = 0; i < function_count; i++) {
+        slim_test_name(out, functions[i]);
+        slim_test_u32(out, bounds[i]);
+        slim_test_u32(out, bounds[i + 1] - bounds[i]);
+    }
+
+    for (u32_t i = 0; i < import_count; i++) {
+        slim_test_name(out, imports[i]);
+    }
+
+    for (u32_t i = 0; i < count; i++) {
+        u8_t record[SLIM_INSTRUCTION_SIZE];
+        slim_instruction_encode(record, program[i]);
+        fwrite(record, sizeof(record), 1, out);
+    }
+    fclose(out);
+}
+
+static u32_t slim_test_address(SlimImage* image, const char* name) {
+    u32_t address = 0;
+    slim_check(slim_image_lookup(image, name, &address) == SL_ERROR_NONE);
+    return address;
+}
+
+static void slim_test_modules(void) {
+    char directory[32];
+    strcpy(directory, "/tmp/slim-test-XXXXXX");
+    slim_check(mkdtemp(directory) != NULL);
+
+    char main_path[64], library_path[64], broken_path[64];
+    snprintf(main_path, sizeof(main_path), "%s/main.slm", directory);
+    snprintf(library_path, sizeof(library_path), "%s/library.slm", directory);
+    snprintf(broken_path, sizeof(broken_path), "%s/broken.slm", directory);
+
+    // main hands 21 to double in the library, which comes back through finish to store the result in register 1
+    SlimInstruction main_code[] = {
+        {SL_OPCODE_LOADI, 0, 21},
+        {SL_OPCODE_JMPX, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_STORER, 1, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    const char* main_functions[] = {"main", "finish"};
+    u32_t main_bounds[] = {0, 3 * SLIM_INSTRUCTION_SIZE, SLIM_TEST_MODULE_SIZE};
+    const char* main_imports[] = {"double"};
+    slim_test_module(main_path, main_code, slim_test_length(main_code), main_functions, main_bounds, 2, main_imports, 1);
+
+    // double loops inside itself three times and then jumps to the start of tail, targets are module relative
+    SlimInstruction library_code[] = {
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_ADD, 0, 0},
+        {SL_OPCODE_LOADI, 0, 3},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_LOADI, 0, 1},
+        {SL_OPCODE_LOADR, 0, 0},
+        {SL_OPCODE_SUB, 0, 0},
+        {SL_OPCODE_DUP, 0, 0},
+        {SL_OPCODE_STORER, 0, 0},
+        {SL_OPCODE_JNE, 4 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_JMP, 11 * SLIM_INSTRUCTION_SIZE, 0},
+        {SL_OPCODE_JMPX, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+        {SL_OPCODE_HALT, 0, 0},
+    };
+    const char* library_functions[] = {"double", "tail", "unused"};
+    u32_t library_bounds[] = {0, 11 * SLIM_INSTRUCTION_SIZE, 13 * SLIM_INSTRUCTION_SIZE, SLIM_TEST_LIBRARY_SIZE};
+    const char* library_imports[] = {"finish"};
+    slim_test_module(library_path, library_code, slim_test_length(library_code), library_functions, library_bounds, 3,
+        library_imports, 1);
+
+    const char* both[] = {main_path, library_path};
+    SlimImage* image = slim_image_link(both, 2);
+    slim_check(image != NULL);
+    if (image == NULL) {
+        rmdir(directory);
+        return;
+    }
+    slim_check(image->function_count == 5 && image->loaded_count == 0);
+    slim_check(image->size == SLIM_TEST_MODULE_SIZE + SLIM_TEST_LIBRARY_SIZE);
+
+    u32_t entry = slim_test_address(image, "main");
+    u32_t finish = slim_test_address(image, "finish");
+    u32_t twice = slim_test_address(image, "double");
+    u32_t tail = slim_test_address(image, "tail");
+    u32_t unused;
+    slim_check(entry == 0 && finish == 3 * SLIM_INSTRUCTION_SIZE && twice == SLIM_TEST_MODULE_SIZE);
+    slim_check(slim_image_lookup(image, "missing", &unused) == SL_ERROR_LINK);
+
+    // Entering finish on its own loads only finish
+    SlimMachine* machine = slim_machine_create();
+    slim_machine_clear(machine);
+    slim_machine_load_image(machine, image);
+    machine->stack[machine->stack_pointer++] = 5;
+    machine->instruction_pointer = finish;
+    slim_machine_launch(machine);
+    slim_check(machine->flags.halt && !machine->flags.error && machine->registers[1] == 5);
+    slim_check(image->loaded_count == 1);
+
+    // The whole chain loads main, double and tail, unused is never reached
+    slim_machine_clear(machine);
+    slim_machine_launch(machine);
+    slim_check(machine->flags.halt && !machine->flags.error);
+    slim_check(machine->registers[1] == 42 && machine->registers[0] == 0 && machine->stack_pointer == 0);
+    slim_check(machine->instruction_pointer == finish + 2 * SLIM_INSTRUCTION_SIZE);
+    slim_check(image->loaded_count == 4);
+    slim_check(slim_image_lookup(image, "unused", &unused) == SL_ERROR_NONE);
+    for (u32_t i = 0; i < image->function_count; i++) {
+        slim_check(image->functions[i].loaded == (image->functions[i].address != unused));
+    }
+
+    // Targets moved by the library's base, and the imports turned into plain jumps to their functions
+    SlimInstruction loop = slim_instruction_decode(image->data + twice + 9 * SLIM_INSTRUCTION_SIZE);
+    SlimInstruction onward = slim_instruction_decode(image->data + twice + 10 * SLIM_INSTRUCTION_SIZE);
+    SlimInstruction call = slim_instruction_decode(image->data + entry + SLIM_INSTRUCTION_SIZE);
+    SlimInstruction back = slim_instruction_decode(image->data + tail);
+    slim_check(loop.opcode == SL_OPCODE_JNE && loop.arg1 == twice + 4 * SLIM_INSTRUCTION_SIZE);
+    slim_check(onward.opcode == SL_OPCODE_JMP && onward.arg1 == tail);
+    slim_check(call.opcode == SL_OPCODE_JMP && call.arg1 == twice);
+    slim_check(back.opcode == SL_OPCODE_JMP && back.arg1 == finish);
+
+    // Loading a function again is a no-op
+    slim_check(slim_image_load(image, twice) == SL_ERROR_NONE && image->loaded_count == 4);
+    slim_check(slim_image_load(image, twice + SLIM_INSTRUCTION_SIZE) == SL_ERROR_LINK);
+    slim_machine_destroy(machine);
+    slim_image_destroy(image);
+
+    // An import nobody exports
+    const char* missing[] = {"nowhere"};
+    slim_test_module(broken_path, main_code, slim_test_length(main_code), main_functions, main_bounds, 2, missing, 1);
+    const char* unresolved[] = {broken_path, library_path};
+    slim_check(slim_image_link(unresolved, 2) == NULL);
+
+    // The same name exported twice
+    const char* duplicates[] = {"main", "double", "finish"};
+    slim_test_module(broken_path, library_code, slim_test_length(library_code), duplicates, library_bounds, 3,
+        library_imports, 1);
+    const char* duplicated[] = {main_path, broken_path};
+    slim_check(slim_image_link(duplicated, 2) == NULL);
+
+    // Functions that leave the end of the code uncovered, or overlap
+    u32_t short_bounds[] = {0, 11 * SLIM_INSTRUCTION_SIZE, 13 * SLIM_INSTRUCTION_SIZE};
+    slim_test_module(broken_path, library_code, slim_test_length(library_code), library_functions, short_bounds, 2,
+        library_imports, 1);
+    const char* untiled[] = {main_path, broken_path};
+    slim_check(slim_image_link(untiled, 2) == NULL);
+    u32_t overlapping_bounds[] = {0, 11 * SLIM_INSTRUCTION_SIZE, 10 * SLIM_INSTRUCTION_SIZE, SLIM_TEST_LIBRARY_SIZE};
+    slim_test_module(broken_path, library_code, slim_test_length(library_code), library_functions, overlapping_bounds,
+        3, library_imports, 1);
+    slim_check(slim_image_link(untiled, 2) == NULL);
+
+    // Jumps past the code or into the middle of another function link, but fail when their function loads
+    SlimInstruction astray[slim_test_length(library_code)];
+    const char* broken[] = {main_path, broken_path};
+    for (u32_t target = 0; target < 3; target++) {
+        u32_t targets[] = {SLIM_TEST_LIBRARY_SIZE, 12 * SLIM_INSTRUCTION_SIZE, 4 * SLIM_INSTRUCTION_SIZE + 1};
+        memcpy(astray, library_code, sizeof(library_code));
+        astray[10].arg1 = targets[target];
+        slim_test_module(broken_path, astray, slim_test_length(astray), library_functions, library_bounds, 3,
+            library_imports, 1);
+        image = slim_image_link(broken, 2);
+        slim_check(image != NULL);
+        if (image != NULL) {
+            slim_check(slim_image_load(image, SLIM_TEST_MODULE_SIZE) == SL_ERROR_LINK);
+            slim_check(image->loaded_count == 0 && !image->functions[2].loaded);
+            slim_image_destroy(image);
+        }
+    }
+
+    // As does a JMPX past the import table or a LAZY in a body, the machine faults and halts on the function's first instruction
+    for (u32_t stray = 0; stray < 2; stray++) {
+        memcpy(astray, library_code, sizeof(library_code));
+        astray[10] = stray ? (SlimInstruction){SL_OPCODE_LAZY, 0, 0} : (SlimInstruction){SL_OPCODE_JMPX, 1, 0};
+        slim_test_module(broken_path, astray, slim_test_length(astray), library_functions, library_bounds, 3,
+            library_imports, 1);
+        image = slim_image_link(broken, 2);
+        slim_check(image != NULL);
+        if (image != NULL) {
+            machine = slim_machine_create();
+            slim_machine_clear(machine);
+            slim_machine_load_image(machine, image);
+            slim_machine_launch(machine);
+            slim_check(machine->flags.error && machine->flags.halt && machine->stats.faults[SL_ERROR_LINK] == 1);
+            slim_check(machine->instruction_pointer == SLIM_TEST_MODULE_SIZE + SLIM_INSTRUCTION_SIZE);
+            slim_check(image->loaded_count == 1 && image->functions[0].loaded && !image->functions[2].loaded);
+            slim_machine_destroy(machine);
+            slim_image_destroy(image);
+        }
+    }
+
+    unlink(main_path);
+    unlink(library_path);
+    unlink(broken_path);
+    rmdir(directory);
+}
 
 // Test ----------------------------------------------------------------------------------------------------------------
 int main(void) {
@@ -16,4 +1557,23 @@ int main(void) {
     slim_machine_dump_stack(machine);
     slim_machine_dump_registers(machine);
     slim_machine_dump_memory(machine);
-}
\ No newline at end of file
+
+    slim_test_natives();
+    slim_test_pool();
+    slim_test_channels();
+    slim_test_spawn();
+    slim_test_segments();
+    slim_test_streams();
+    slim_test_tables();
+    slim_test_stats();
+    slim_test_traces();
+    slim_test_aot();
+    slim_test_optimizer();
+    slim_test_modules();
+
+    if (slim_test_failures > 0) {
+        fprintf(stderr, "%u checks failed\n", slim_test_failures);
+        return 1;
+    }
+    return 0;
+}
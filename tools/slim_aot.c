@@ -0,0 +1,315 @@
+#include "../slim.h"
+// slim-aot: translates a .slx program into C, one label per basic block and jumps as goto. Stack operations are inlined
+// on machine->stack behind a single depth check per block, a block that would fault is stepped through by the
+// interpreter instead so errors behave exactly as they do there. The output is meant to be compiled into a shared
+// object and bound with slim_machine_load_object in place of the interpreter.
+//
+//     slim-aot program.slx program.aot.c
+//     clang -O3 -shared -fPIC -I. program.aot.c -o program.so
+// ---------------------------------------------------------------------------------------------------------------------
+// Stack effect of an instruction the emitter inlines, anything else goes through the interpreter's routine
+typedef struct SlimAotEffect SlimAotEffect;
+struct SlimAotEffect {
+    u8_t inlined;
+    u8_t pops;
+    u8_t pushes;
+};
+
+static SlimAotEffect slim_aot_effect(SlimInstruction instruction) {
+    SlimAotEffect effect = {1, 0, 0};
+    switch (instruction.opcode) {
+    case SL_OPCODE_NOOP:
+    case SL_OPCODE_HALT:
+    case SL_OPCODE_JMP: break;
+    case SL_OPCODE_LOADI: effect.pushes = 1; break;
+    case SL_OPCODE_LOADR:
+        effect.inlined = instruction.arg1 < SLIM_MACHINE_REGISTERS;
+        effect.pushes = 1;
+        break;
+    case SL_OPCODE_STORER:
+        effect.inlined = instruction.arg1 < SLIM_MACHINE_REGISTERS;
+        effect.pops = 1;
+        break;
+    case SL_OPCODE_LOADM: effect.pops = 1, effect.pushes = 1; break;
+    case SL_OPCODE_DROP: effect.pops = 1; break;
+    case SL_OPCODE_STOREM: effect.pops = 2; break;
+    case SL_OPCODE_DUP: effect.pops = 1, effect.pushes = 2; break;
+    case SL_OPCODE_SWAP: effect.pops = 2, effect.pushes = 2; break;
+    case SL_OPCODE_ROT: effect.pops = 3, effect.pushes = 3; break;
+    case SL_OPCODE_ADD:
+    case SL_OPCODE_SUB:
+    case SL_OPCODE_MUL:
+    case SL_OPCODE_DIV: effect.pops = 2, effect.pushes = 1; break;
+    case SL_OPCODE_JNE:
+    case SL_OPCODE_JE: effect.pops = 1; break;
+    default: effect.inlined = 0; break;
+    }
+    return effect;
+}
+
+static u8_t slim_aot_is_target(SlimBytecode* bytecode, u32_t target) {
+    return target < bytecode->bytesize && target % SLIM_INSTRUCTION_SIZE == 0;
+}
+
+// Blocks start at the entry, at jump and spawn targets and after anything that can leave straight-line flow
+static u8_t* slim_aot_leaders(SlimBytecode* bytecode) {
+    u8_t* leaders = calloc(bytecode->size + 1, 1);
+    if (leaders == NULL) {
+        return NULL;
+    }
+
+    leaders[0] = 1;
+    for (u32_t i = 0; i < bytecode->size; i++) {
+        SlimInstruction instruction = slim_instruction_decode(bytecode->data + i * SLIM_INSTRUCTION_SIZE);
+        switch (instruction.opcode) {
+        case SL_OPCODE_JMP:
+        case SL_OPCODE_JNE:
+        case SL_OPCODE_JE:
+        case SL_OPCODE_SPAWN:
+            if (slim_aot_is_target(bytecode, instruction.arg1)) {
+                leaders[instruction.arg1 / SLIM_INSTRUCTION_SIZE] = 1;
+            }
+            leaders[i + 1] = 1;
+            break;
+        case SL_OPCODE_HALT: leaders[i + 1] = 1; break;
+        default:
+            if (!slim_aot_effect(instruction).inlined) {
+                leaders[i + 1] = 1;
+            }
+            break;
+        }
+    }
+    return leaders;
+}
+
+static void slim_aot_emit_prologue(FILE* out, const char* source, SlimBytecode* bytecode, u8_t* leaders) {
+    fprintf(out, "// Generated by slim-aot from %s, do not edit\n", source);
+    fprintf(out, "#include \"slim.h\"\n\n");
+    // Checked by slim_machine_load_object against the bytecode the object is bound to
+    fprintf(out, "const u64_t %s = 0x%llxULL;\n", SLIM_AOT_HASH, slim_bytecode_hash(bytecode->data, bytecode->bytesize));
+    fprintf(out, "const u32_t %s = %u;\n\n", SLIM_AOT_SIZE, bytecode->bytesize);
+
+    fprintf(out, "void %s(SlimMachine* machine) {\n", SLIM_AOT_ENTRY);
+    fprintf(out, "    u64_t* stack = machine->stack;\n");
+    fprintf(out, "    u64_t a;\n");
+    fprintf(out, "    (void)stack, (void)a;\n\n");
+
+    // Only block starts are entered directly, the interpreter steps through everything else up to the next one
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    switch (machine->instruction_pointer) {\n");
+    for (u32_t i = 0; i < bytecode->size; i++) {
+        if (leaders[i]) {
+            fprintf(out, "    case %u: goto B_%u;\n", i * SLIM_INSTRUCTION_SIZE, i * SLIM_INSTRUCTION_SIZE);
+        }
+    }
+    fprintf(out, "    default:\n");
+    fprintf(out, "        if (machine->instruction_pointer < %u && machine->instruction_pointer %% %u == 0) goto step;\n",
+        bytecode->bytesize, SLIM_INSTRUCTION_SIZE);
+    fprintf(out, "        printf(\"Invalid instruction pointer\\n\");\n");
+    fprintf(out, "        machine->flags.error = 1;\n");
+    fprintf(out, "        machine->flags.halt = 1;\n");
+    fprintf(out, "        return;\n");
+    fprintf(out, "    }\n\n");
+
+    // One interpreted instruction, for blocks whose stack check failed and for entries in the middle of a block
+    fprintf(out, "step: __attribute__((unused));\n");
+    fprintf(out, "    {\n");
+    fprintf(out, "        SlimInstruction instruction = slim_machine_fetch(machine);\n");
+    fprintf(out, "        slim_machine_execute(machine, slim_machine_decode(machine, instruction), instruction);\n");
+    fprintf(out, "        machine->stats.instructions += !machine->flags.wait;\n");
+    fprintf(out, "        if (machine->flags.halt || machine->flags.wait) return;\n");
+    fprintf(out, "        goto dispatch;\n");
+    fprintf(out, "    }\n\n");
+}
+
+static void slim_aot_emit_epilogue(FILE* out, SlimBytecode* bytecode) {
+    // Falling off the end leaves the instruction pointer out of range, which the dispatch above rejects
+    fprintf(out, "B_%u: __attribute__((unused));\n", bytecode->bytesize);
+    fprintf(out, "    machine->instruction_pointer = %u;\n", bytecode->bytesize);
+    fprintf(out, "    return;\n");
+    fprintf(out, "}\n");
+}
+
+static void slim_aot_emit_jump(FILE* out, SlimBytecode* bytecode, u32_t target) {
+    if (slim_aot_is_target(bytecode, target)) {
+        fprintf(out, "goto B_%u;", target);
+    } else {
+        fprintf(out, "{ machine->instruction_pointer = %u; return; }", target);
+    }
+}
+
+// The block's stack depth range is checked once on entry, so the inlined instructions below need no checks of their own
+static void slim_aot_emit_block(FILE* out, SlimBytecode* bytecode, u8_t* leaders, u32_t first) {
+    u32_t address = first * SLIM_INSTRUCTION_SIZE;
+    s32_t depth = 0;
+    s32_t low = 0;
+    s32_t high = 0;
+    u32_t count = 0;
+
+    for (u32_t i = first; i < bytecode->size && (i == first || !leaders[i]); i++) {
+        SlimAotEffect effect = slim_aot_effect(slim_instruction_decode(bytecode->data + i * SLIM_INSTRUCTION_SIZE));
+        if (!effect.inlined) {
+            break;
+        }
+
+        depth -= effect.pops;
+        low = depth < low ? depth : low;
+        depth += effect.pushes;
+        high = depth > high ? depth : high;
+        count++;
+    }
+
+    fprintf(out, "B_%u:\n", address);
+    if (count > 0) {
+        fprintf(out, "    if (machine->stack_pointer < %d || machine->stack_pointer > %d) {\n", -low,
+            SLIM_MACHINE_STACK_SIZE - high);
+        fprintf(out, "        machine->instruction_pointer = %u;\n", address);
+        fprintf(out, "        goto step;\n");
+        fprintf(out, "    }\n");
+        fprintf(out, "    machine->stats.instructions += %u;\n", count);
+        if (high > 0) {
+            fprintf(out, "    if (machine->stack_pointer + %d > machine->stats.stack_high) ", high);
+            fprintf(out, "machine->stats.stack_high = machine->stack_pointer + %d;\n", high);
+        }
+    }
+}
+
+static void slim_aot_emit_instruction(FILE* out, SlimBytecode* bytecode, u32_t address, SlimInstruction instruction) {
+    u32_t next = address + SLIM_INSTRUCTION_SIZE;
+
+    fprintf(out, "    // %u: 0x%02x 0x%x 0x%x\n", address, instruction.opcode, instruction.arg1, instruction.arg2);
+
+    // Pops zero the slot they free, like ___slim_machine_pop
+    if (slim_aot_effect(instruction).inlined) {
+        switch (instruction.opcode) {
+        case SL_OPCODE_NOOP: break;
+        case SL_OPCODE_HALT:
+            fprintf(out, "    machine->instruction_pointer = %u;\n", next);
+            fprintf(out, "    machine->flags.halt = 1;\n");
+            fprintf(out, "    return;\n");
+            break;
+        case SL_OPCODE_LOADI:
+            fprintf(out, "    stack[machine->stack_pointer++] = 0x%llxULL;\n",
+                (u64_t)instruction.arg1 << 32 | instruction.arg2);
+            break;
+        case SL_OPCODE_LOADR:
+            fprintf(out, "    stack[machine->stack_pointer++] = machine->registers[%u];\n", instruction.arg1);
+            break;
+        case SL_OPCODE_STORER:
+            fprintf(out, "    machine->registers[%u] = stack[--machine->stack_pointer];\n", instruction.arg1);
+            fprintf(out, "    stack[machine->stack_pointer] = 0;\n");
+            break;
+        case SL_OPCODE_LOADM:
+            fprintf(out, "    stack[machine->stack_pointer - 1] = ");
+            fprintf(out, "machine->memory[(u32_t)stack[machine->stack_pointer - 1] + %u];\n", instruction.arg1);
+            break;
+        case SL_OPCODE_DROP:
+            fprintf(out, "    stack[--machine->stack_pointer] = 0;\n");
+            break;
+        case SL_OPCODE_STOREM:
+            fprintf(out, "    a = (u32_t)stack[machine->stack_pointer - 1] + %u;\n", instruction.arg1);
+            fprintf(out, "    machine->memory[a] = stack[machine->stack_pointer - 2];\n");
+            fprintf(out, "    stack[--machine->stack_pointer] = 0;\n");
+            fprintf(out, "    stack[--machine->stack_pointer] = 0;\n");
+            fprintf(out, "    slim_machine_mark_dirty(machine, (u32_t)a, 1);\n");
+            break;
+        case SL_OPCODE_DUP:
+            fprintf(out, "    stack[machine->stack_pointer] = stack[machine->stack_pointer - 1];\n");
+            fprintf(out, "    machine->stack_pointer++;\n");
+            break;
+        case SL_OPCODE_SWAP:
+            fprintf(out, "    a = stack[machine->stack_pointer - 1];\n");
+            fprintf(out, "    stack[machine->stack_pointer - 1] = stack[machine->stack_pointer - 2];\n");
+            fprintf(out, "    stack[machine->stack_pointer - 2] = a;\n");
+            break;
+        case SL_OPCODE_ROT:
+            fprintf(out, "    a = stack[machine->stack_pointer - 3];\n");
+            fprintf(out, "    stack[machine->stack_pointer - 3] = stack[machine->stack_pointer - 2];\n");
+            fprintf(out, "    stack[machine->stack_pointer - 2] = stack[machine->stack_pointer - 1];\n");
+            fprintf(out, "    stack[machine->stack_pointer - 1] = a;\n");
+            break;
+        case SL_OPCODE_ADD:
+        case SL_OPCODE_SUB:
+        case SL_OPCODE_MUL:
+        case SL_OPCODE_DIV: {
+            const char* operator= instruction.opcode == SL_OPCODE_ADD ? "+"
+                                  : instruction.opcode == SL_OPCODE_SUB ? "-"
+                                  : instruction.opcode == SL_OPCODE_MUL ? "*"
+                                                                        : "/";
+            fprintf(out, "    stack[machine->stack_pointer - 2] = stack[machine->stack_pointer - 1] %s ", operator);
+            fprintf(out, "stack[machine->stack_pointer - 2];\n");
+            fprintf(out, "    stack[--machine->stack_pointer] = 0;\n");
+            break;
+        }
+        case SL_OPCODE_JMP:
+            fprintf(out, "    ");
+            slim_aot_emit_jump(out, bytecode, instruction.arg1);
+            fprintf(out, "\n");
+            break;
+        case SL_OPCODE_JNE:
+        case SL_OPCODE_JE:
+            fprintf(out, "    a = stack[--machine->stack_pointer];\n");
+            fprintf(out, "    stack[machine->stack_pointer] = 0;\n");
+            fprintf(out, "    if (a %s 0) ", instruction.opcode == SL_OPCODE_JNE ? "!=" : "==");
+            slim_aot_emit_jump(out, bytecode, instruction.arg1);
+            fprintf(out, "\n");
+            break;
+        }
+        return;
+    }
+
+    // Anything without a specialised translation goes through the interpreter's own routine and ends its block
+    fprintf(out, "    {\n");
+    fprintf(out, "        SlimInstruction instruction = {0x%x, 0x%x, 0x%x};\n", instruction.opcode, instruction.arg1,
+        instruction.arg2);
+    fprintf(out, "        machine->instruction_pointer = %u;\n", next);
+    fprintf(out, "        slim_machine_execute(machine, slim_machine_decode(machine, instruction), instruction);\n");
+    fprintf(out, "        machine->stats.instructions += !machine->flags.wait;\n");
+    fprintf(out, "        if (machine->flags.halt || machine->flags.wait) return;\n");
+    fprintf(out, "        if (machine->instruction_pointer != %u) goto dispatch;\n", next);
+    fprintf(out, "    }\n");
+}
+// ---------------------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s <program.slx> <output.c>\n", argv[0]);
+        return 1;
+    }
+
+    SlimBytecode* bytecode = slim_bytecode_load(argv[1]);
+    if (bytecode == NULL) {
+        printf("Failed to load bytecode\n");
+        return 1;
+    }
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == NULL) {
+        printf("Failed to open output\n");
+        slim_bytecode_destroy(bytecode);
+        return 1;
+    }
+
+    u8_t* leaders = slim_aot_leaders(bytecode);
+    if (leaders == NULL) {
+        printf("Failed to allocate memory\n");
+        fclose(out);
+        slim_bytecode_destroy(bytecode);
+        return 1;
+    }
+
+    slim_aot_emit_prologue(out, argv[1], bytecode, leaders);
+    for (u32_t i = 0; i < bytecode->size; i++) {
+        if (leaders[i]) {
+            slim_aot_emit_block(out, bytecode, leaders, i);
+        }
+
+        SlimInstruction instruction = slim_instruction_decode(bytecode->data + i * SLIM_INSTRUCTION_SIZE);
+        slim_aot_emit_instruction(out, bytecode, i * SLIM_INSTRUCTION_SIZE, instruction);
+    }
+    slim_aot_emit_epilogue(out, bytecode);
+
+    free(leaders);
+    fclose(out);
+    slim_bytecode_destroy(bytecode);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "../slim.h"
+// slim-bench: times programs end to end, each run is clear + load + launch on the same machine. The machine's own
+// tracing goes to stdout, so stdout is discarded and the results are reported on stderr. Build it with -DSLIM_QUIET so
+// the interpreter is not timed writing its per-instruction log, which the trace and compiled paths never do.
+//
+//     slim-bench [-n ITERATIONS] [-t] program.slx [-o program.so] program.slx ...
+//
+// A -t runs the program that follows it on the plain interpreter, with hot loop traces turned off.
+// An -o object is bound for the program that follows it, which makes interpreter vs compiled a single invocation.
+// ---------------------------------------------------------------------------------------------------------------------
+#include <string.h>
+#include <time.h>
+
+static f64_t slim_bench_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (f64_t)now.tv_sec + (f64_t)now.tv_nsec / 1e9;
+}
+
+static s32_t slim_bench_run(const char* program, const char* object, u8_t traced, u32_t iterations, f64_t* seconds) {
+    SlimBytecode* bytecode = slim_bytecode_load(program);
+    if (bytecode == NULL) {
+        return 1;
+    }
+
+    // The object is checked against the bytecode, so it can only be bound once that is loaded
+    SlimMachine* machine = slim_machine_create();
+    if (!traced) {
+        slim_trace_cache_destroy(machine->traces);
+        machine->traces = NULL;
+    }
+
+    slim_machine_load(machine, bytecode->data, bytecode->bytesize);
+    if (object != NULL && slim_machine_load_object(machine, object) != SL_ERROR_NONE) {
+        fprintf(stderr, "%s does not run %s\n", object, program);
+        machine->bytecode = NULL;
+        slim_machine_destroy(machine);
+        slim_bytecode_destroy(bytecode);
+        return 1;
+    }
+
+    f64_t start = slim_bench_now();
+    for (u32_t i = 0; i < iterations; i++) {
+        slim_machine_clear(machine);
+        slim_machine_load(machine, bytecode->data, bytecode->bytesize);
+        slim_machine_launch(machine);
+    }
+    *seconds = slim_bench_now() - start;
+
+    // The bytecode is owned by us, not by the machine
+    machine->bytecode = NULL;
+    slim_machine_destroy(machine);
+    slim_bytecode_destroy(bytecode);
+    return 0;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    u32_t iterations = 10;
+    const char* object = NULL;
+    u8_t traced = 1;
+    f64_t baseline = 0;
+
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Failed to silence stdout\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = (u32_t)strtoul(argv[++i], NULL, 10);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            object = argv[++i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-t") == 0) {
+            traced = 0;
+            continue;
+        }
+
+        f64_t seconds;
+        if (slim_bench_run(argv[i], object, traced, iterations, &seconds) != 0) {
+            fprintf(stderr, "Failed to run %s\n", argv[i]);
+            return 1;
+        }
+
+        if (baseline == 0) {
+            baseline = seconds;
+        }
+
+        fprintf(stderr, "%-24s %-10s %10.3f ms/run %8.2fx\n", argv[i],
+            object   ? "compiled"
+            : traced ? "traced"
+                     : "interpreted",
+            seconds * 1e3 / iterations, baseline / seconds);
+        object = NULL;
+        traced = 1;
+    }
+
+    return 0;
+}
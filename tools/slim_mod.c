@@ -0,0 +1,131 @@
+#include "../slim.h"
+// slim-mod: packs a .slx program into a .slm module and links and runs modules. Function offsets are byte addresses in
+// the program, each function runs up to the next one, and JMPX IMPORT in the program refers to the -i names in order.
+//
+//     slim-mod pack program.slx module.slm -f NAME@OFFSET... [-i NAME]...
+//     slim-mod run module.slm...
+//
+// Running starts at address 0, the first function of the first module, and reports on stderr how much of the image
+// was actually loaded.
+// ---------------------------------------------------------------------------------------------------------------------
+#include <string.h>
+
+#define SLIM_MOD_MAX_SYMBOLS 256
+
+static void slim_mod_u32(FILE* out, u32_t value) {
+    u8_t data[4] = {value >> 24, value >> 16, value >> 8, value};
+    fwrite(data, sizeof(data), 1, out);
+}
+
+static void slim_mod_name(FILE* out, const char* name) {
+    char data[SLIM_MODULE_NAME_SIZE] = {0};
+    strncpy(data, name, SLIM_MODULE_NAME_SIZE - 1);
+    fwrite(data, sizeof(data), 1, out);
+}
+
+static s32_t slim_mod_pack(int argc, char** argv) {
+    char* functions[SLIM_MOD_MAX_SYMBOLS];
+    u32_t offsets[SLIM_MOD_MAX_SYMBOLS];
+    char* imports[SLIM_MOD_MAX_SYMBOLS];
+    u32_t function_count = 0;
+    u32_t import_count = 0;
+
+    for (int i = 4; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-f") == 0 && function_count < SLIM_MOD_MAX_SYMBOLS) {
+            char* at = strchr(argv[i + 1], '@');
+            if (at == NULL) {
+                printf("Expected NAME@OFFSET, got %s\n", argv[i + 1]);
+                return 1;
+            }
+            *at = 0;
+            functions[function_count] = argv[i + 1];
+            offsets[function_count++] = (u32_t)strtoul(at + 1, NULL, 0);
+        } else if (strcmp(argv[i], "-i") == 0 && import_count < SLIM_MOD_MAX_SYMBOLS) {
+            imports[import_count++] = argv[i + 1];
+        } else {
+            printf("Unexpected argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    SlimBytecode* bytecode = slim_bytecode_load(argv[2]);
+    if (bytecode == NULL) {
+        printf("Failed to load bytecode\n");
+        return 1;
+    }
+
+    // The linker checks the rest, here we only make sure the sizes come out right
+    if (function_count == 0 || offsets[0] != 0) {
+        printf("The first function has to start at 0\n");
+        slim_bytecode_destroy(bytecode);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[3], "wb");
+    if (out == NULL) {
+        printf("Failed to open output\n");
+        slim_bytecode_destroy(bytecode);
+        return 1;
+    }
+
+    slim_mod_u32(out, SLIM_MODULE_MAGIC);
+    slim_mod_u32(out, SLIM_VERSION);
+    slim_mod_u32(out, function_count);
+    slim_mod_u32(out, import_count);
+    slim_mod_u32(out, bytecode->bytesize);
+
+    for (u32_t i = 0; i < function_count; i++) {
+        u32_t end = i + 1 < function_count ? offsets[i + 1] : bytecode->bytesize;
+        slim_mod_name(out, functions[i]);
+        slim_mod_u32(out, offsets[i]);
+        slim_mod_u32(out, end - offsets[i]);
+    }
+
+    for (u32_t i = 0; i < import_count; i++) {
+        slim_mod_name(out, imports[i]);
+    }
+
+    fwrite(bytecode->data, bytecode->bytesize, 1, out);
+    fclose(out);
+    slim_bytecode_destroy(bytecode);
+    return 0;
+}
+
+static s32_t slim_mod_run(int argc, char** argv) {
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Failed to silence stdout\n");
+        return 1;
+    }
+
+    SlimImage* image = slim_image_link((const char**)argv + 2, (u32_t)argc - 2);
+    if (image == NULL) {
+        fprintf(stderr, "Failed to link\n");
+        return 1;
+    }
+
+    SlimMachine* machine = slim_machine_create();
+    slim_machine_load_image(machine, image);
+    slim_machine_launch(machine);
+
+    u64_t result = machine->stack_pointer > 0 ? machine->stack[machine->stack_pointer - 1] : 0;
+    fprintf(stderr, "result %llu, %s, loaded %u of %u functions\n", result, machine->flags.error ? "error" : "ok",
+        image->loaded_count, image->function_count);
+
+    slim_machine_destroy(machine);
+    slim_image_destroy(image);
+    return 0;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (argc >= 4 && strcmp(argv[1], "pack") == 0) {
+        return slim_mod_pack(argc, argv);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "run") == 0) {
+        return slim_mod_run(argc, argv);
+    }
+
+    printf("Usage: %s pack <program.slx> <module.slm> -f NAME@OFFSET... [-i NAME]...\n", argv[0]);
+    printf("       %s run <module.slm>...\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,446 @@
+#include "../slim.h"
+// slim-opt: offline bytecode optimizer. Builds the control flow graph of a .slx program, then repeats
+//
+//     - constant folding of LOADI LOADI <op>, LOADI <branch> and LOADI LOADI SWAP
+//     - block local constant propagation of registers into LOADR
+//     - dead STORER elimination, a store overwritten before any LOADR of the register becomes DROP
+//     - removal of redundant stack traffic: SWAP SWAP, DUP DROP, LOADI/LOADR DROP, NOOP, JMP to the next instruction
+//     - removal of blocks that are unreachable from the entry
+//
+// until nothing changes, and writes the program back out with the jump targets relocated.
+//
+//     slim-opt program.slx program.opt.slx
+//
+// Rewrites assume the program does not rely on stack faults, a folded sequence can no longer overflow the stack.
+// ---------------------------------------------------------------------------------------------------------------------
+#include <string.h>
+
+typedef struct SlimProgram SlimProgram;
+struct SlimProgram {
+    SlimInstruction* code;
+    u8_t* removed;
+    u8_t* leader;
+    u8_t* reachable;
+    u32_t* relocated;
+    u32_t size;
+};
+
+static u8_t slim_opt_is_jump(u8_t opcode) {
+    return opcode == SL_OPCODE_JMP || opcode == SL_OPCODE_JNE || opcode == SL_OPCODE_JE;
+}
+
+// Instructions whose first argument is a code address, SPAWN starts a child there
+static u8_t slim_opt_has_target(u8_t opcode) {
+    return slim_opt_is_jump(opcode) || opcode == SL_OPCODE_SPAWN;
+}
+
+static u8_t slim_opt_ends_block(u8_t opcode) {
+    return slim_opt_is_jump(opcode) || opcode == SL_OPCODE_HALT;
+}
+
+static u64_t slim_opt_immediate(SlimInstruction instruction) {
+    return (u64_t)instruction.arg1 << 32 | instruction.arg2;
+}
+
+static SlimInstruction slim_opt_loadi(u64_t value) {
+    SlimInstruction instruction = {SL_OPCODE_LOADI, (u32_t)(value >> 32), (u32_t)value};
+    return instruction;
+}
+
+// First live instruction at or after the given index, this is where control lands when jumping to it
+static u32_t slim_opt_resolve(SlimProgram* program, u32_t index) {
+    while (index < program->size && program->removed[index]) {
+        index++;
+    }
+    return index;
+}
+
+// Next live instruction after the given one within the same block, or program->size. Leaders removed since the
+// last scan still count as block boundaries.
+static u32_t slim_opt_next(SlimProgram* program, u32_t index) {
+    for (u32_t next = index + 1; next < program->size; next++) {
+        if (program->leader[next]) {
+            return program->size;
+        }
+
+        if (!program->removed[next]) {
+            return next;
+        }
+    }
+    return program->size;
+}
+
+static u8_t slim_opt_valid_targets(SlimProgram* program) {
+    for (u32_t i = 0; i < program->size; i++) {
+        SlimInstruction instruction = program->code[i];
+        if (slim_opt_has_target(instruction.opcode) &&
+            (instruction.arg1 % SLIM_INSTRUCTION_SIZE != 0 ||
+                instruction.arg1 / SLIM_INSTRUCTION_SIZE >= program->size)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+// Control Flow --------------------------------------------------------------------------------------------------------
+static void slim_opt_find_leaders(SlimProgram* program) {
+    memset(program->leader, 0, program->size);
+
+    u32_t entry = slim_opt_resolve(program, 0);
+    if (entry < program->size) {
+        program->leader[entry] = 1;
+    }
+
+    for (u32_t i = 0; i < program->size; i++) {
+        if (program->removed[i]) {
+            continue;
+        }
+
+        SlimInstruction instruction = program->code[i];
+        if (slim_opt_has_target(instruction.opcode)) {
+            u32_t target = slim_opt_resolve(program, instruction.arg1 / SLIM_INSTRUCTION_SIZE);
+            if (target < program->size) {
+                program->leader[target] = 1;
+            }
+        }
+
+        if (slim_opt_ends_block(instruction.opcode)) {
+            u32_t next = slim_opt_resolve(program, i + 1);
+            if (next < program->size) {
+                program->leader[next] = 1;
+            }
+        }
+    }
+}
+
+static u8_t slim_opt_remove_unreachable(SlimProgram* program) {
+    u32_t* worklist = malloc(sizeof(u32_t) * (program->size + 1));
+    u32_t pending = 0;
+    u8_t changed = 0;
+
+    memset(program->reachable, 0, program->size);
+
+    u32_t entry = slim_opt_resolve(program, 0);
+    if (entry < program->size) {
+        program->reachable[entry] = 1;
+        worklist[pending++] = entry;
+    }
+
+    // Walk each block to its end, queueing the blocks it can continue into
+    while (pending > 0) {
+        u32_t i = worklist[--pending];
+        for (; i < program->size; i = slim_opt_resolve(program, i + 1)) {
+            program->reachable[i] = 1;
+            SlimInstruction instruction = program->code[i];
+
+            if (slim_opt_has_target(instruction.opcode)) {
+                u32_t target = slim_opt_resolve(program, instruction.arg1 / SLIM_INSTRUCTION_SIZE);
+                if (target < program->size && !program->reachable[target]) {
+                    program->reachable[target] = 1;
+                    worklist[pending++] = target;
+                }
+            }
+
+            if (instruction.opcode == SL_OPCODE_JMP || instruction.opcode == SL_OPCODE_HALT) {
+                break;
+            }
+
+            u32_t next = slim_opt_resolve(program, i + 1);
+            if (next < program->size && program->leader[next]) {
+                if (!program->reachable[next]) {
+                    program->reachable[next] = 1;
+                    worklist[pending++] = next;
+                }
+                break;
+            }
+        }
+    }
+
+    for (u32_t i = 0; i < program->size; i++) {
+        if (!program->removed[i] && !program->reachable[i]) {
+            program->removed[i] = 1;
+            changed = 1;
+        }
+    }
+
+    free(worklist);
+    return changed;
+}
+// Peephole ------------------------------------------------------------------------------------------------------------
+static u8_t slim_opt_fold(SlimProgram* program, u32_t i) {
+    SlimInstruction* code = program->code;
+    u8_t first = code[i].opcode;
+
+    if (first == SL_OPCODE_NOOP) {
+        program->removed[i] = 1;
+        return 1;
+    }
+
+    if (first == SL_OPCODE_JMP) {
+        u32_t target = slim_opt_resolve(program, code[i].arg1 / SLIM_INSTRUCTION_SIZE);
+        if (target == slim_opt_resolve(program, i + 1)) {
+            program->removed[i] = 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    u32_t j = slim_opt_next(program, i);
+    if (j == program->size) {
+        return 0;
+    }
+
+    u8_t second = code[j].opcode;
+
+    u8_t pushes = first == SL_OPCODE_DUP || first == SL_OPCODE_LOADI || first == SL_OPCODE_LOADR;
+    if ((first == SL_OPCODE_SWAP && second == SL_OPCODE_SWAP) || (pushes && second == SL_OPCODE_DROP)) {
+        program->removed[i] = 1;
+        program->removed[j] = 1;
+        return 1;
+    }
+
+    if (first != SL_OPCODE_LOADI) {
+        return 0;
+    }
+
+    u64_t b = slim_opt_immediate(code[i]);
+
+    // A constant condition is either an unconditional jump or nothing at all
+    if (second == SL_OPCODE_JNE || second == SL_OPCODE_JE) {
+        u8_t taken = second == SL_OPCODE_JNE ? b != 0 : b == 0;
+        program->removed[i] = 1;
+        if (taken) {
+            code[j].opcode = SL_OPCODE_JMP;
+        } else {
+            program->removed[j] = 1;
+        }
+        return 1;
+    }
+
+    if (second != SL_OPCODE_LOADI) {
+        return 0;
+    }
+
+    u64_t a = slim_opt_immediate(code[j]);
+    u32_t k = slim_opt_next(program, j);
+    if (k == program->size) {
+        return 0;
+    }
+
+    // The operators take the top of the stack as their left hand side
+    switch (code[k].opcode) {
+    case SL_OPCODE_ADD: code[k] = slim_opt_loadi(a + b); break;
+    case SL_OPCODE_SUB: code[k] = slim_opt_loadi(a - b); break;
+    case SL_OPCODE_MUL: code[k] = slim_opt_loadi(a * b); break;
+    case SL_OPCODE_DIV:
+        if (b == 0) {
+            return 0;
+        }
+        code[k] = slim_opt_loadi(a / b);
+        break;
+    case SL_OPCODE_SWAP:
+        code[i] = slim_opt_loadi(a);
+        code[j] = slim_opt_loadi(b);
+        program->removed[k] = 1;
+        return 1;
+    default: return 0;
+    }
+
+    program->removed[i] = 1;
+    program->removed[j] = 1;
+    return 1;
+}
+
+static u8_t slim_opt_peephole(SlimProgram* program) {
+    u8_t changed = 0;
+    for (u32_t i = 0; i < program->size; i++) {
+        if (!program->removed[i] && slim_opt_fold(program, i)) {
+            changed = 1;
+        }
+    }
+    return changed;
+}
+// Registers -----------------------------------------------------------------------------------------------------------
+// Both passes are block local, any opcode they do not model forgets everything known about the registers
+static u8_t slim_opt_registers(SlimProgram* program) {
+    u8_t known[SLIM_MACHINE_REGISTERS] = {0};
+    u64_t constant[SLIM_MACHINE_REGISTERS];
+    s64_t pending[SLIM_MACHINE_REGISTERS];
+    s64_t previous = -1;
+    u8_t changed = 0;
+
+    for (u32_t r = 0; r < SLIM_MACHINE_REGISTERS; r++) {
+        pending[r] = -1;
+    }
+
+    for (u32_t i = 0; i < program->size; i++) {
+        if (program->removed[i]) {
+            continue;
+        }
+
+        SlimInstruction* instruction = &program->code[i];
+        u32_t r = instruction->arg1;
+
+        if (program->leader[i]) {
+            for (u32_t n = 0; n < SLIM_MACHINE_REGISTERS; n++) {
+                known[n] = 0;
+                pending[n] = -1;
+            }
+            previous = -1;
+        }
+
+        switch (instruction->opcode) {
+        case SL_OPCODE_LOADR:
+            if (r >= SLIM_MACHINE_REGISTERS) {
+                break;
+            }
+            pending[r] = -1;
+            if (known[r]) {
+                *instruction = slim_opt_loadi(constant[r]);
+                changed = 1;
+            }
+            break;
+        case SL_OPCODE_STORER:
+            if (r >= SLIM_MACHINE_REGISTERS) {
+                break;
+            }
+            if (pending[r] >= 0) {
+                program->code[pending[r]].opcode = SL_OPCODE_DROP;
+                program->code[pending[r]].arg1 = 0;
+                changed = 1;
+            }
+            pending[r] = i;
+            known[r] = previous >= 0 && program->code[previous].opcode == SL_OPCODE_LOADI;
+            if (known[r]) {
+                constant[r] = slim_opt_immediate(program->code[previous]);
+            }
+            break;
+        case SL_OPCODE_NOOP:
+        case SL_OPCODE_LOADI:
+        case SL_OPCODE_LOADM:
+        case SL_OPCODE_DROP:
+        case SL_OPCODE_STOREM:
+        case SL_OPCODE_DUP:
+        case SL_OPCODE_SWAP:
+        case SL_OPCODE_ROT:
+        case SL_OPCODE_ADD:
+        case SL_OPCODE_SUB:
+        case SL_OPCODE_MUL:
+        case SL_OPCODE_DIV:
+        case SL_OPCODE_ALLOC:
+        case SL_OPCODE_FREE: break;
+        default:
+            for (u32_t n = 0; n < SLIM_MACHINE_REGISTERS; n++) {
+                known[n] = 0;
+                pending[n] = -1;
+            }
+            break;
+        }
+
+        // Registers stay visible after the block ends, so a store is only dead within it
+        if (slim_opt_ends_block(instruction->opcode)) {
+            for (u32_t n = 0; n < SLIM_MACHINE_REGISTERS; n++) {
+                pending[n] = -1;
+            }
+        }
+
+        previous = i;
+    }
+
+    return changed;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+static u32_t slim_opt_relocate(SlimProgram* program) {
+    u32_t live = 0;
+    for (u32_t i = 0; i <= program->size; i++) {
+        program->relocated[i] = live * SLIM_INSTRUCTION_SIZE;
+        if (i < program->size && !program->removed[i]) {
+            live++;
+        }
+    }
+
+    for (u32_t i = 0; i < program->size; i++) {
+        if (!program->removed[i] && slim_opt_has_target(program->code[i].opcode)) {
+            u32_t target = slim_opt_resolve(program, program->code[i].arg1 / SLIM_INSTRUCTION_SIZE);
+            program->code[i].arg1 = program->relocated[target];
+        }
+    }
+
+    return live;
+}
+
+static s32_t slim_opt_write(SlimProgram* program, u32_t live, const char* filename) {
+    u8_t* data = malloc(live * SLIM_INSTRUCTION_SIZE + 1);
+    u32_t offset = 0;
+
+    for (u32_t i = 0; i < program->size; i++) {
+        if (!program->removed[i]) {
+            slim_instruction_encode(data + offset, program->code[i]);
+            offset += SLIM_INSTRUCTION_SIZE;
+        }
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Failed to open output\n");
+        free(data);
+        return 1;
+    }
+
+    fwrite(data, offset, 1, file);
+    fclose(file);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s <program.slx> <output.slx>\n", argv[0]);
+        return 1;
+    }
+
+    SlimBytecode* bytecode = slim_bytecode_load(argv[1]);
+    if (bytecode == NULL) {
+        printf("Failed to load bytecode\n");
+        return 1;
+    }
+
+    SlimProgram program;
+    program.size = bytecode->size;
+    program.code = malloc(sizeof(SlimInstruction) * (program.size + 1));
+    program.removed = calloc(program.size + 1, 1);
+    program.leader = calloc(program.size + 1, 1);
+    program.reachable = calloc(program.size + 1, 1);
+    program.relocated = malloc(sizeof(u32_t) * (program.size + 1));
+
+    for (u32_t i = 0; i < program.size; i++) {
+        program.code[i] = slim_instruction_decode(bytecode->data + i * SLIM_INSTRUCTION_SIZE);
+    }
+
+    // Jumps into the middle of an instruction can't be relocated, such programs are copied unchanged
+    u8_t changed = slim_opt_valid_targets(&program);
+    if (!changed) {
+        printf("Unaligned jump targets, leaving the program unchanged\n");
+    }
+
+    while (changed) {
+        slim_opt_find_leaders(&program);
+        changed = slim_opt_remove_unreachable(&program);
+        changed |= slim_opt_registers(&program);
+        changed |= slim_opt_peephole(&program);
+    }
+
+    u32_t live = slim_opt_relocate(&program);
+    s32_t status = slim_opt_write(&program, live, argv[2]);
+    if (status == 0) {
+        printf("%s: %u -> %u instructions (%.1f%% fewer)\n", argv[1], program.size, live,
+            program.size ? 100.0 * (program.size - live) / program.size : 0.0);
+    }
+
+    free(program.code);
+    free(program.removed);
+    free(program.leader);
+    free(program.reachable);
+    free(program.relocated);
+    slim_bytecode_destroy(bytecode);
+    return status;
+}